@@ -0,0 +1,108 @@
+#include "arena.h"
+#include "quadtree.h"
+
+#include <algorithm>
+#include <new>
+#include <type_traits>
+
+// reset() never runs destructors, so nodes must not own anything.
+static_assert(std::is_trivially_destructible<QuadTree>::value,
+        "QuadTree nodes are released in bulk by NodeArena::reset()");
+
+// first block for leaf buckets, allocated on first use
+#define BUCKET_BLOCK (64 * 1024)
+
+NodeArena::NodeArena(size_t initialCapacity) : leafCapacity(1), used(0), total(0), bytesUsed(0) {
+    addBlock(initialCapacity > 0 ? initialCapacity : 1);
+}
+
+NodeArena::~NodeArena() {
+    freeBlocks();
+}
+
+void NodeArena::addBlock(size_t nodes) {
+    blocks.push_back(static_cast<QuadTree *>(::operator new(nodes * sizeof(QuadTree))));
+    blockCapacity.push_back(nodes);
+    used = 0;
+}
+
+void NodeArena::freeBlocks() {
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        ::operator delete(blocks[i]);
+    }
+    blocks.clear();
+    blockCapacity.clear();
+    for (unsigned int i = 0; i < byteBlocks.size(); i++) {
+        ::operator delete(byteBlocks[i]);
+    }
+    byteBlocks.clear();
+    byteCapacity.clear();
+}
+
+QuadTree *NodeArena::newNode(const Quadrant &quadrant) {
+    if (used == blockCapacity.back()) {
+        addBlock(2 * blockCapacity.back());
+    }
+    QuadTree *node = new (&blocks.back()[used]) QuadTree(this, quadrant);
+    used++;
+    total++;
+    return node;
+}
+
+void *NodeArena::allocate(size_t bytes) {
+    bytes = (bytes + 7) & ~(size_t)7;
+    if (byteBlocks.empty() || bytesUsed + bytes > byteCapacity.back()) {
+        size_t cap = byteBlocks.empty() ? BUCKET_BLOCK : 2 * byteCapacity.back();
+        cap = std::max(cap, bytes);
+        byteBlocks.push_back(static_cast<char *>(::operator new(cap)));
+        byteCapacity.push_back(cap);
+        bytesUsed = 0;
+    }
+    void *res = byteBlocks.back() + bytesUsed;
+    bytesUsed += bytes;
+    return res;
+}
+
+LeafBucket *NodeArena::newBucket(int capacity) {
+    char *raw = static_cast<char *>(allocate(sizeof(LeafBucket)
+            + capacity * (sizeof(Body *) + 3 * sizeof(double))));
+    LeafBucket *bucket = reinterpret_cast<LeafBucket *>(raw);
+    raw += sizeof(LeafBucket);
+    bucket->bodies = reinterpret_cast<Body **>(raw);
+    raw += capacity * sizeof(Body *);
+    bucket->x = reinterpret_cast<double *>(raw);
+    bucket->y = bucket->x + capacity;
+    bucket->m = bucket->y + capacity;
+    bucket->capacity = capacity;
+    return bucket;
+}
+
+void NodeArena::reset() {
+    size_t cap = capacity();
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < byteCapacity.size(); i++) {
+        bytes += byteCapacity[i];
+    }
+    if (blocks.size() > 1 || byteBlocks.size() > 1) {
+        // last tree spilled over several blocks, keep one that fits it whole
+        freeBlocks();
+        addBlock(cap);
+        byteBlocks.push_back(static_cast<char *>(::operator new(bytes)));
+        byteCapacity.push_back(bytes);
+    }
+    used = 0;
+    total = 0;
+    bytesUsed = 0;
+}
+
+size_t NodeArena::size() {
+    return total;
+}
+
+size_t NodeArena::capacity() {
+    size_t cap = 0;
+    for (unsigned int i = 0; i < blockCapacity.size(); i++) {
+        cap += blockCapacity[i];
+    }
+    return cap;
+}
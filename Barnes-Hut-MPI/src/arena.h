@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "quadrant.h"
+
+class QuadTree;
+struct Body;
+
+/**
+ * Bodies of a QuadTree leaf when leaves hold more than one (-k). The
+ * pointers are kept for when the leaf splits, and x, y and m are copied
+ * out as they arrive so the leaf can go straight through accumulateAccel.
+ */
+typedef struct LeafBucket {
+    Body **bodies;
+    double *x;
+    double *y;
+    double *m;
+    int capacity;
+} LeafBucket;
+
+/**
+ * Bump allocator for QuadTree nodes.
+ *
+ * Nodes are handed out from large blocks and are never freed individually;
+ * reset() discards the whole tree in O(1) so the same storage can be reused
+ * by the next step. If a step overflows the current block, reset() merges
+ * everything into one block big enough for the next tree of that size.
+ * Leaf buckets come from a second set of blocks handled the same way.
+ */
+class NodeArena {
+public:
+    NodeArena(size_t initialCapacity = 1024);
+    ~NodeArena();
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    QuadTree *newNode(const Quadrant &quadrant);
+    LeafBucket *newBucket(int capacity);
+    void reset();
+
+    // bodies a leaf holds before it splits, 1 for one body per leaf
+    int leafCapacity;
+
+    size_t size();
+    size_t capacity();
+
+private:
+    std::vector<QuadTree *> blocks;
+    std::vector<size_t> blockCapacity;
+    size_t used;        // nodes handed out from the current (last) block
+    size_t total;       // nodes handed out since the last reset
+    std::vector<char *> byteBlocks;
+    std::vector<size_t> byteCapacity;
+    size_t bytesUsed;
+
+    void addBlock(size_t nodes);
+    void freeBlocks();
+    void *allocate(size_t bytes);
+};
+
+#endif
@@ -1,4 +1,22 @@
 #include "argparse.h"
+#include "integrator.h"
+
+#include <algorithm>
+
+// long-only options, numbered past every short option character
+enum {
+    OPT_CHECKPOINT_EVERY = 256,
+    OPT_RESTART,
+    OPT_TRAJECTORY,
+    OPT_TRAJECTORY_EVERY,
+    OPT_DIMENSIONS,
+    OPT_REFIT,
+    OPT_BLOCK_LEVELS,
+    OPT_INTEGRATOR,
+    OPT_DIAGNOSTICS,
+    OPT_DIAGNOSTICS_EVERY,
+    OPT_PROFILE
+};
 
 void get_opts(int argc,
               char **argv,
@@ -13,12 +31,71 @@ void get_opts(int argc,
         std::cout << "\t-t <theta>" << std::endl;
         std::cout << "\t-d <dt/time_step>" << std::endl;
         std::cout << "\t-v <visualize_flag>" << std::endl;
+        std::cout << "\t-l <linear_tree_flag>" << std::endl;
+        std::cout << "\t-m <morton_build_flag>" << std::endl;
+        std::cout << "\t-g <group_size>" << std::endl;
+        std::cout << "\t-p <distributed_flag>" << std::endl;
+        std::cout << "\t-a <allgather_flag>" << std::endl;
+        std::cout << "\t-b <balance_flag>" << std::endl;
+        std::cout << "\t-j <threads>" << std::endl;
+        std::cout << "\t-f <binary_output_flag>" << std::endl;
+        std::cout << "\t-q <quadrupole_flag>" << std::endl;
+        std::cout << "\t-e <fmm_order>" << std::endl;
+        std::cout << "\t-k <leaf_capacity>" << std::endl;
+        std::cout << "\t--checkpoint-every <steps>" << std::endl;
+        std::cout << "\t--restart <checkpoint_file>" << std::endl;
+        std::cout << "\t--trajectory <trajectory_file>" << std::endl;
+        std::cout << "\t--trajectory-every <steps>" << std::endl;
+        std::cout << "\t--dimensions <2|3>" << std::endl;
+        std::cout << "\t--refit <rebuild_every>" << std::endl;
+        std::cout << "\t--block-levels <max_level>" << std::endl;
+        std::cout << "\t--integrator <taylor|leapfrog|yoshida>" << std::endl;
+        std::cout << "\t--diagnostics <csv_file>" << std::endl;
+        std::cout << "\t--diagnostics-every <steps>" << std::endl;
+        std::cout << "\t--profile <name>" << std::endl;
         exit(0);
     }
     opts->visualize = false;
+    opts->linear = false;
+    opts->morton = false;
+    opts->distributed = false;
+    opts->allgather = false;
+    opts->balance = false;
+    opts->groupSize = 0;
+    opts->threads = 1;
+    opts->binary = false;
+    opts->quadrupole = false;
+    opts->fmmOrder = 0;
+    opts->leafCapacity = 1;
+    opts->checkpointEvery = 0;
+    opts->restartFileName = nullptr;
+    opts->trajectoryFileName = nullptr;
+    opts->trajectoryEvery = 1;
+    opts->dimensions = 0;
+    opts->refitEvery = 0;
+    opts->blockLevels = 0;
+    opts->integrator = INTEGRATOR_TAYLOR;
+    opts->diagnosticsFileName = nullptr;
+    opts->diagnosticsEvery = 1;
+    opts->profileName = nullptr;
+
+    static struct option longOptions[] = {
+        {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+        {"restart", required_argument, NULL, OPT_RESTART},
+        {"trajectory", required_argument, NULL, OPT_TRAJECTORY},
+        {"trajectory-every", required_argument, NULL, OPT_TRAJECTORY_EVERY},
+        {"dimensions", required_argument, NULL, OPT_DIMENSIONS},
+        {"refit", required_argument, NULL, OPT_REFIT},
+        {"block-levels", required_argument, NULL, OPT_BLOCK_LEVELS},
+        {"integrator", required_argument, NULL, OPT_INTEGRATOR},
+        {"diagnostics", required_argument, NULL, OPT_DIAGNOSTICS},
+        {"diagnostics-every", required_argument, NULL, OPT_DIAGNOSTICS_EVERY},
+        {"profile", required_argument, NULL, OPT_PROFILE},
+        {NULL, 0, NULL, 0}
+    };
 
     int c;
-    while ((c = getopt(argc, argv, "i:o:s:t:d:v")) != -1)
+    while ((c = getopt_long(argc, argv, "i:o:s:t:d:vlmg:pabj:fqe:k:", longOptions, NULL)) != -1)
     {
         switch (c)
         {
@@ -42,9 +119,139 @@ void get_opts(int argc,
         case 'v':
             opts->visualize = true;
             break;
+        case 'l':
+            opts->linear = true;
+            break;
+        case 'm':
+            // the Morton build produces a LinearTree directly
+            opts->morton = true;
+            opts->linear = true;
+            break;
+        case 'g':
+            // groups are cut from the LinearTree
+            opts->groupSize = atoi((char *)optarg);
+            opts->linear = true;
+            break;
+        case 'p':
+            // ranks build Morton trees over their own bodies only
+            opts->distributed = true;
+            opts->morton = true;
+            opts->linear = true;
+            break;
+        case 'a':
+            opts->allgather = true;
+            break;
+        case 'b':
+            // cost zones need contiguous ownership along the Morton order
+            opts->balance = true;
+            opts->allgather = true;
+            opts->morton = true;
+            opts->linear = true;
+            break;
+        case 'j':
+            opts->threads = atoi((char *)optarg);
+            break;
+        case 'f':
+            // the input format is detected, the output one is chosen here
+            opts->binary = true;
+            break;
+        case 'q':
+            opts->quadrupole = true;
+            break;
+        case 'e':
+            // the FMM runs over the Morton-built LinearTree, theta is its opening angle
+            opts->fmmOrder = atoi((char *)optarg);
+            if (opts->fmmOrder < 1) {
+                std::cerr << argv[0] << ": -e takes an order of 1 or more." << std::endl;
+                exit(1);
+            }
+            opts->morton = true;
+            opts->linear = true;
+            break;
+        case 'k':
+            // bodies a leaf holds before it is split, in every tree
+            opts->leafCapacity = std::max(atoi((char *)optarg), 1);
+            break;
+        case OPT_CHECKPOINT_EVERY:
+            // written to <output_file>.ckpt
+            opts->checkpointEvery = atoi((char *)optarg);
+            break;
+        case OPT_RESTART:
+            // the checkpoint replaces -i, and its dt/theta replace -d/-t
+            opts->restartFileName = optarg;
+            opts->inputFileName = optarg;
+            break;
+        case OPT_TRAJECTORY:
+            opts->trajectoryFileName = optarg;
+            break;
+        case OPT_TRAJECTORY_EVERY:
+            opts->trajectoryEvery = atoi((char *)optarg);
+            break;
+        case OPT_DIMENSIONS:
+            // 3 runs on SpatialTree<3>, 2 is the usual 2D trees
+            opts->dimensions = atoi((char *)optarg);
+            if (opts->dimensions != 2 && opts->dimensions != 3) {
+                std::cerr << argv[0] << ": --dimensions takes 2 or 3." << std::endl;
+                exit(1);
+            }
+            if (opts->dimensions == 2) {
+                opts->dimensions = 0;
+            }
+            break;
+        case OPT_REFIT:
+            // keep the pointer tree between steps, rebuilding at least this often
+            opts->refitEvery = atoi((char *)optarg);
+            break;
+        case OPT_BLOCK_LEVELS:
+            // bodies step by dt / 2^level for levels up to this one
+            opts->blockLevels = atoi((char *)optarg);
+            if (opts->blockLevels < 0 || opts->blockLevels > 20) {
+                std::cerr << argv[0] << ": --block-levels takes 0 to 20." << std::endl;
+                exit(1);
+            }
+            break;
+        case OPT_INTEGRATOR:
+            opts->integrator = integratorFromName(optarg);
+            if (opts->integrator < 0) {
+                std::cerr << argv[0] << ": --integrator takes taylor, leapfrog or yoshida." << std::endl;
+                exit(1);
+            }
+            break;
+        case OPT_DIAGNOSTICS:
+            // energies and momenta, taken alongside the forces
+            opts->diagnosticsFileName = optarg;
+            break;
+        case OPT_DIAGNOSTICS_EVERY:
+            opts->diagnosticsEvery = atoi((char *)optarg);
+            break;
+        case OPT_PROFILE:
+            // phase times and walk counts, written to <name>.csv and <name>.json
+            opts->profileName = optarg;
+            break;
         case ':':
             std::cerr << argv[0] << ": option -" << (char)optopt << "requires an argument." << std::endl;
             exit(1);
         }
     }
+    if (opts->fmmOrder > 0 && opts->distributed) {
+        std::cerr << argv[0] << ": -e does not combine with -p." << std::endl;
+        exit(1);
+    }
+    if (opts->refitEvery > 0 && opts->morton) {
+        std::cerr << argv[0] << ": --refit keeps the pointer tree, it does not combine with -m, -b, -p or -e." << std::endl;
+        exit(1);
+    }
+    if (opts->blockLevels > 0 && (opts->distributed || opts->fmmOrder > 0
+            || opts->integrator != INTEGRATOR_TAYLOR)) {
+        std::cerr << argv[0] << ": --block-levels does not combine with -p, -e or --integrator." << std::endl;
+        exit(1);
+    }
+    if (opts->dimensions > 0 && (opts->distributed || opts->groupSize > 0 || opts->quadrupole
+            || opts->fmmOrder > 0 || opts->checkpointEvery > 0 || opts->restartFileName != nullptr
+            || opts->trajectoryFileName != nullptr || opts->leafCapacity > 1 || opts->refitEvery > 0
+            || opts->blockLevels > 0 || opts->integrator != INTEGRATOR_TAYLOR
+            || opts->diagnosticsFileName != nullptr || opts->profileName != nullptr)) {
+        std::cerr << argv[0] << ": --dimensions only runs the plain tree walk (-s -t -d -j -f -v)." << std::endl;
+        exit(1);
+    }
 }
@@ -13,6 +13,28 @@ struct options_t {
     double theta;
     double timeStep;
     bool visualize;
+    bool linear;
+    bool morton;
+    bool distributed;
+    bool allgather;
+    bool balance;
+    int groupSize;
+    int threads;
+    bool binary;
+    bool quadrupole;
+    int fmmOrder;
+    int leafCapacity;
+    int checkpointEvery;
+    char *restartFileName;
+    char *trajectoryFileName;
+    int trajectoryEvery;
+    int dimensions;
+    int refitEvery;
+    int blockLevels;
+    int integrator;
+    char *diagnosticsFileName;
+    int diagnosticsEvery;
+    char *profileName;
 };
 
 typedef struct options_t options_t;
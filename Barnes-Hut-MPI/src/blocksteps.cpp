@@ -0,0 +1,102 @@
+#include "blocksteps.h"
+
+#include <algorithm>
+
+BlockSteps::BlockSteps(int count, int maxLevel, double dt)
+        : maxLevel(maxLevel), dtMin(dt / (1 << maxLevel)), tick(0),
+          base(count), start(count, 0), end(count, 0), ax(count, 0.0), ay(count, 0.0) {
+}
+
+int BlockSteps::substeps() {
+    return 1 << maxLevel;
+}
+
+bool BlockSteps::isActive(const Body &body) {
+    return end[body.index] == tick;
+}
+
+void BlockSteps::setForce(const Body &body, double fx, double fy) {
+    ax[body.index] = fx / body.m;
+    ay[body.index] = fy / body.m;
+}
+
+int BlockSteps::chooseLevel(int index) {
+    double a = sqrt(ax[index] * ax[index] + ay[index] * ay[index]);
+    int level = 0;
+    if (a > 0) {
+        double limit = BLOCK_ETA * sqrt(rLimit / a);
+        while (level < maxLevel && dtMin * (1 << (maxLevel - level)) > limit) {
+            level++;
+        }
+    }
+    // a longer step than the last one has to start on a multiple of itself
+    while (tick % (1 << (maxLevel - level)) != 0) {
+        level++;
+    }
+    return level;
+}
+
+void BlockSteps::share(std::vector<Body> &bodies, std::vector<unsigned int> &indices, int size) {
+    if (size == 1) {
+        return;
+    }
+    // (slot, cost, ax, ay) for every body this rank walked for, the
+    // cost so that all ranks split the next tick's work the same way;
+    // bodies walked along with a group only pass on what they had
+    std::vector<double> mine;
+    for (unsigned int j = 0; j < indices.size(); j++) {
+        const Body &body = bodies[indices[j]];
+        if (body.m > 0) {
+            mine.push_back(indices[j]);
+            mine.push_back(body.cost);
+            mine.push_back(ax[body.index]);
+            mine.push_back(ay[body.index]);
+        }
+    }
+    int count = mine.size();
+    std::vector<int> counts(size), displs(size);
+    MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int r = 0; r < size; r++) {
+        displs[r] = total;
+        total += counts[r];
+    }
+    std::vector<double> all(total);
+    MPI_Allgatherv(mine.data(), count, MPI_DOUBLE, all.data(), counts.data(), displs.data(),
+            MPI_DOUBLE, MPI_COMM_WORLD);
+    for (int k = 0; k < total; k += 4) {
+        Body &body = bodies[(int)all[k]];
+        body.cost = (int)all[k + 1];
+        ax[body.index] = all[k + 2];
+        ay[body.index] = all[k + 3];
+    }
+}
+
+void BlockSteps::advance(std::vector<Body> &bodies, ThreadPool &pool) {
+    pool.parallelFor(bodies.size(), 256, [&](int j, int thread) {
+        Body &body = bodies[j];
+        int index = body.index;
+        if (body.m <= 0) {
+            return;
+        }
+        if (isActive(body)) {
+            base[index] = body;
+            start[index] = tick;
+            end[index] = tick + (1 << (maxLevel - chooseLevel(index)));
+        }
+        // the calcNewPos update over the time since the step started
+        double t = (tick + 1 - start[index]) * dtMin;
+        const Body &from = base[index];
+        body.x = from.x + (from.vx * t) + (0.5 * ax[index] * t * t);
+        body.y = from.y + (from.vy * t) + (0.5 * ay[index] * t * t);
+        body.vx = from.vx + (ax[index] * t);
+        body.vy = from.vy + (ay[index] * t);
+    });
+
+    tick++;
+    if (tick == substeps()) {
+        // every step ends with the global one, so the next starts from 0
+        tick = 0;
+        std::fill(end.begin(), end.end(), 0);
+    }
+}
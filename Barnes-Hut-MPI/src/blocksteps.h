@@ -0,0 +1,67 @@
+#ifndef BLOCKSTEPS_H
+#define BLOCKSTEPS_H
+
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+#include "threadpool.h"
+
+// a body's step is at most BLOCK_ETA * sqrt(rLimit / |a|)
+#define BLOCK_ETA 0.25
+
+/**
+ * Hierarchical block timesteps (--block-levels). Each global step dt is
+ * cut into 2^maxLevel ticks, and a body on level L takes steps of
+ * dt / 2^L, starting on a multiple of its own length. At every tick only
+ * the bodies whose step ends there are active: they get a new force and
+ * start their next step, on the level their acceleration calls for.
+ *
+ * Between their own steps bodies are moved along with the calcNewPos
+ * update (the force held fixed), so the tree of every tick sees all of
+ * them where they are at that time. A body that reaches the end of its
+ * step lands exactly where calcNewPos would have put it, and with
+ * maxLevel = 0 a run is the plain global step.
+ *
+ * State is kept by body index. Every rank holds all bodies, and since the
+ * accelerations are shared and the rest is computed the same way
+ * everywhere, ranks never need to send each other bodies.
+ */
+class BlockSteps {
+public:
+    BlockSteps(int count, int maxLevel, double dt);
+
+    int substeps();
+
+    // whether body starts a new step at the current tick
+    bool isActive(const Body &body);
+
+    // the force an active body starts its new step with
+    void setForce(const Body &body, double fx, double fy);
+
+    /**
+     * Shares the forces set on this rank's `indices` (slots in bodies,
+     * which agree between ranks) with all ranks.
+     */
+    void share(std::vector<Body> &bodies, std::vector<unsigned int> &indices, int size);
+
+    // finishes the current tick: starts the active bodies' new steps and
+    // moves every body on to the next tick
+    void advance(std::vector<Body> &bodies, ThreadPool &pool);
+
+private:
+    int maxLevel;
+    double dtMin;
+    int tick;
+    // per body index: where its current step started, at which tick it
+    // started and ends, and its acceleration over it
+    std::vector<Body> base;
+    std::vector<int> start;
+    std::vector<int> end;
+    std::vector<double> ax;
+    std::vector<double> ay;
+
+    int chooseLevel(int index);
+};
+
+#endif
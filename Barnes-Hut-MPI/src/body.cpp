@@ -1,7 +1,26 @@
 #include "body.h"
 
+void BodyArrays::clear() {
+    index.clear();
+    x.clear();
+    y.clear();
+    m.clear();
+}
+
+void BodyArrays::push(Body &body) {
+    index.push_back(body.index);
+    x.push_back(body.x);
+    y.push_back(body.y);
+    m.push_back(body.m);
+}
+
+int BodyArrays::size() {
+    return index.size();
+}
+
 void copy(Body &src, Body &dst) {
     dst.index = src.index;
+    dst.cost = src.cost;
     dst.x = src.x;
     dst.y = src.y;
     dst.m = src.m;
@@ -11,28 +30,33 @@ void copy(Body &src, Body &dst) {
     // dst.fy = src.fy;
 }
 
-void getFromString(Body &body, std::string line) {
-    std::stringstream strStream(line);
-    std::string temp;
-    strStream >> temp;
-    body.index = stoi(temp);
-    strStream >> temp;
-    body.x = stod(temp);
-    strStream >> temp;
-    body.y = stod(temp);
-    strStream >> temp;
-    body.m = stod(temp);
-    strStream >> temp;
-    body.vx = stod(temp);
-    strStream >> temp;
-    body.vy = stod(temp);
-    // body.fx = 0;
-    // body.fy = 0;
+const char *skipSpace(const char *first, const char *last) {
+    while (first != last && (*first == ' ' || *first == '\t' || *first == '\r')) {
+        first++;
+    }
+    return first;
+}
+
+const char *endOfLine(const char *first, const char *last) {
+    first = skipSpace(first, last);
+    return first == last || *first == '\n' ? first : nullptr;
+}
+
+const char *parseBody(const char *first, const char *last, Body &body) {
+    std::from_chars_result res;
+    res = std::from_chars(skipSpace(first, last), last, body.index);
+    double *fields[5] = { &body.x, &body.y, &body.m, &body.vx, &body.vy };
+    for (int i = 0; i < 5 && res.ec == std::errc(); i++) {
+        res = std::from_chars(skipSpace(res.ptr, last), last, *fields[i]);
+    }
+    body.cost = 0;
+    return res.ec == std::errc() ? endOfLine(res.ptr, last) : nullptr;
 }
 
 Body *clone(Body *body) {
     Body *res = (Body *)malloc(sizeof(Body));
     res->index = -1;
+    res->cost = 0;
     res->x = body->x;
     res->y = body->y;
     res->m = body->m;
@@ -55,26 +79,18 @@ void calcNewPos(Body *body, double dt, double fx, double fy) {
     body->vy = body->vy + (ay * dt);
 }
 
-std::string createLine(Body *body) {
-    std::string res = "";
-    res += std::to_string(body->index);
-    res += "\t";
-    res += std::to_string(body->x);
-    res += "\t";
-    res += std::to_string(body->y);
-    res += "\t";
-    res += std::to_string(body->m);
-    res += "\t";
-    res += std::to_string(body->vx);
-    res += "\t";
-    res += std::to_string(body->vy);
-    res += "\n";
-    return res;
+char *formatBody(char *out, char *last, const Body &body) {
+    // fixed with 6 digits is what std::to_string wrote before
+    out = std::to_chars(out, last, body.index).ptr;
+    const double fields[5] = { body.x, body.y, body.m, body.vx, body.vy };
+    for (int i = 0; i < 5; i++) {
+        *out++ = '\t';
+        out = std::to_chars(out, last, fields[i], std::chars_format::fixed, 6).ptr;
+    }
+    *out++ = '\n';
+    return out;
 }
 
-static double G = 0.0001;
-static double rLimit = 0.03;
-
 // Direction of force is correct for b1, inverted for b2
 std::pair<double, double> calcF(Body *b1, Body *b2) {
     double xDiff = b2->x - b1->x;
@@ -93,4 +109,12 @@ double calcF(double m1, double m2, double d) {
 double calcDimF(double m1, double m2, double d, double dx) {
     double temp = d < rLimit ? rLimit : d;
     return ( G * m1 * m2 * dx ) / (temp * temp * temp);
+}
+
+double calcPotential(double m1, double m2, double d) {
+    if (d >= rLimit) {
+        return -G * m1 * m2 / d;
+    }
+    // inside rLimit the force grows linearly, which makes this a parabola
+    return -G * m1 * m2 * (3 * rLimit * rLimit - d * d) / (2 * rLimit * rLimit * rLimit);
 }
\ No newline at end of file
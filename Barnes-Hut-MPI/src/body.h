@@ -6,11 +6,13 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <charconv>
 #include "math.h"
 
 
 typedef struct Body {
     int index;
+    int cost;       // interactions its force took last step, for load balancing
     double x;
     double y;
     double m;
@@ -20,11 +22,49 @@ typedef struct Body {
     // double fy;
 } Body;
 
+/**
+ * The fields of Body the force walks read, one array per field, for loops
+ * that stream over many bodies at a time (see kernels.h).
+ */
+typedef struct BodyArrays {
+    std::vector<int> index;
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> m;
+
+    void clear();
+    void push(Body &body);
+    int size();
+} BodyArrays;
+
+// gravitational constant, and the distance below which forces stop growing
+const double G = 0.0001;
+const double rLimit = 0.03;
+
 void copy(Body &src, Body &dst);
-void getFromString(Body &body, std::string line);
+
+/**
+ * Reads the "index x y m vx vy" line at first, fields separated by spaces
+ * or tabs, without going through a std::string. Returns the end of the
+ * line, or nullptr if a field is missing or malformed or the line holds
+ * more than the six.
+ */
+const char *parseBody(const char *first, const char *last, Body &body);
+// past any spaces, tabs and '\r' at first, never past the end of the line
+const char *skipSpace(const char *first, const char *last);
+// the '\n' (or last) after trailing blanks at first, nullptr if anything else is there
+const char *endOfLine(const char *first, const char *last);
+
 Body *clone(Body *body);
 void calcNewPos(Body *body, double dt, double fx, double fy);
-std::string createLine(Body *body);
+
+/**
+ * Writes body as a tab separated text line ending in a newline, and
+ * returns one past it. [out, last) must hold BODY_LINE_MAX bytes.
+ */
+char *formatBody(char *out, char *last, const Body &body);
+// an int and five doubles in fixed notation, at their widest
+#define BODY_LINE_MAX (12 + 5 * 328 + 1)
 
 std::pair<double, double> calcF(Body *b1, Body *b2);
 
@@ -32,4 +72,7 @@ double calcF(double m1, double m2, double d);
 
 double calcDimF(double m1, double m2, double d, double dx);
 
+// potential energy of two masses at distance d, the potential of calcDimF's force
+double calcPotential(double m1, double m2, double d);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "bounds.h"
+
+#include <algorithm>
+#include <limits>
+
+Quadrant findBounds(std::vector<Body> &bodies, ThreadPool &pool, bool allRanks) {
+    // stored as {-xMin, -yMin, xMax, yMax} so a single MAX reduces all four
+    const double lowest = -std::numeric_limits<double>::infinity();
+    std::vector<double> partial(4 * pool.size(), lowest);
+    pool.parallelFor(bodies.size(), 4096, [&](int i, int thread) {
+        const Body &body = bodies[i];
+        if (body.m <= 0) {
+            return;
+        }
+        double *extent = &partial[4 * thread];
+        extent[0] = std::max(extent[0], -body.x);
+        extent[1] = std::max(extent[1], -body.y);
+        extent[2] = std::max(extent[2], body.x);
+        extent[3] = std::max(extent[3], body.y);
+    });
+    double extent[4] = { lowest, lowest, lowest, lowest };
+    for (int t = 0; t < pool.size(); t++) {
+        for (int k = 0; k < 4; k++) {
+            extent[k] = std::max(extent[k], partial[4 * t + k]);
+        }
+    }
+    if (allRanks) {
+        MPI_Allreduce(MPI_IN_PLACE, extent, 4, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    }
+    if (extent[0] == lowest) {
+        return Quadrant(0.0, 0.0, 4.0, 4.0);
+    }
+
+    double xMin = -extent[0], yMin = -extent[1];
+    double side = std::max(extent[2] - xMin, extent[3] - yMin);
+    if (side <= 0) {
+        side = 1.0;
+    }
+    double pad = side * 1e-9;
+    xMin -= pad;
+    yMin -= pad;
+    side += 2 * pad;
+    return Quadrant(xMin, yMin, xMin + side, yMin + side);
+}
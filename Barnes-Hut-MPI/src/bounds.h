@@ -0,0 +1,20 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+#include "quadrant.h"
+#include "threadpool.h"
+
+/**
+ * Smallest square around every body with mass, padded a hair so the
+ * outermost bodies sit strictly inside. The extent is found with one
+ * min/max per thread of `pool`; with `allRanks` it is then reduced over
+ * MPI_COMM_WORLD, so ranks holding different bodies agree on the root.
+ * With no bodies at all it falls back to the old fixed [0, 4] box.
+ */
+Quadrant findBounds(std::vector<Body> &bodies, ThreadPool &pool, bool allRanks);
+
+#endif
@@ -0,0 +1,65 @@
+#include "checkpoint.h"
+#include "io.h"
+
+#include <cstdio>
+#include <iostream>
+
+Checkpointer::Checkpointer(const std::string &fileName, int rank)
+        : fileName(fileName), tmpName(fileName + ".tmp"), rank(rank), pending(false) {}
+
+Checkpointer::~Checkpointer() {
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void Checkpointer::write(std::vector<Body> &bodies, int64_t step, double dt, double theta) {
+    finish();
+    // the copy is the only part the step loop waits for
+    snapshot = bodies;
+    writer = std::thread([this, step, dt, theta]() {
+        writeBinaryFile(tmpName.c_str(), snapshot, step, dt, theta);
+        std::rename(tmpName.c_str(), fileName.c_str());
+    });
+}
+
+void Checkpointer::writeParallel(std::vector<Body> &local, int total, int64_t step,
+        double dt, double theta, int size) {
+    finish();
+    snapshot = local;
+    pending = startWriteParallel(tmpName.c_str(), snapshot, total, step, dt, theta,
+            rank, size, parallelWrite);
+    if (!pending && rank == 0) {
+        std::cerr << "ERROR: unable to write the checkpoint, skipped step " << step << std::endl;
+    }
+}
+
+void Checkpointer::poll() {
+    if (!pending) {
+        return;
+    }
+    int done, allDone;
+    MPI_Test(&parallelWrite.request, &done, MPI_STATUS_IGNORE);
+    MPI_Allreduce(&done, &allDone, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (allDone) {
+        complete();
+    }
+}
+
+void Checkpointer::finish() {
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (pending) {
+        complete();
+    }
+}
+
+void Checkpointer::complete() {
+    finishWriteParallel(parallelWrite);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::rename(tmpName.c_str(), fileName.c_str());
+    }
+    pending = false;
+}
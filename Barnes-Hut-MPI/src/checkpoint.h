@@ -0,0 +1,51 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+#include "parallelio.h"
+
+/**
+ * Writes checkpoints (binary body files, io.h) without holding up the
+ * step loop. Each one goes to `<fileName>.tmp` and is renamed over
+ * fileName once complete, so a crash mid-write keeps the previous one.
+ *
+ * Replicated runs: rank 0 copies its bodies and a background thread
+ * writes the copy. Distributed runs: every rank copies its own bodies and
+ * starts a nonblocking collective write, which poll() completes once all
+ * ranks are done with it.
+ */
+class Checkpointer {
+public:
+    Checkpointer(const std::string &fileName, int rank);
+    ~Checkpointer();
+
+    // rank 0 of a replicated run
+    void write(std::vector<Body> &bodies, int64_t step, double dt, double theta);
+    // every rank of a distributed run
+    void writeParallel(std::vector<Body> &local, int total, int64_t step,
+            double dt, double theta, int size);
+
+    // collective while a parallel write is pending
+    void poll();
+    // waits for the pending write, collective like poll()
+    void finish();
+
+private:
+    std::string fileName;
+    std::string tmpName;
+    int rank;
+    std::vector<Body> snapshot;
+    std::thread writer;
+    bool pending;
+    ParallelWrite parallelWrite;
+
+    void complete();
+};
+
+#endif
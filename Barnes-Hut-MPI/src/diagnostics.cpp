@@ -0,0 +1,41 @@
+#include "diagnostics.h"
+
+#include <iomanip>
+
+void Diagnostics::clear() {
+    kinetic = potential = px = py = lz = 0;
+}
+
+void Diagnostics::add(const Body &body, double vx, double vy, double potential) {
+    kinetic += 0.5 * body.m * (vx * vx + vy * vy);
+    this->potential += 0.5 * potential;
+    px += body.m * vx;
+    py += body.m * vy;
+    lz += body.m * (body.x * vy - body.y * vx);
+}
+
+DiagnosticsLog::DiagnosticsLog(int rank) : rank(rank) {
+}
+
+bool DiagnosticsLog::open(const char *fileName) {
+    out.open(fileName, std::ofstream::trunc);
+    out << "step,time,kinetic,potential,total,px,py,lz" << std::endl;
+    return (bool)out;
+}
+
+void DiagnosticsLog::record(Diagnostics &diagnostics, int step, double time) {
+    double sums[5] = { diagnostics.kinetic, diagnostics.potential, diagnostics.px,
+            diagnostics.py, diagnostics.lz };
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : sums, sums, 5, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        return;
+    }
+    out << step << ',' << time << std::setprecision(12) << std::scientific;
+    out << ',' << sums[0] << ',' << sums[1] << ',' << sums[0] + sums[1];
+    for (int k = 2; k < 5; k++) {
+        out << ',' << sums[k];
+    }
+    // back to the defaults for the next step and time
+    out << std::defaultfloat << std::setprecision(6) << '\n';
+    out.flush();
+}
@@ -0,0 +1,46 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <fstream>
+
+#include "mpi.h"
+#include "body.h"
+
+/**
+ * Conserved quantities over one rank's bodies, added up by run() on a
+ * --diagnostics step alongside the forces. Each body's potential energy
+ * is summed by its force walk (or the FMM), over the same accepted cells'
+ * monopoles and opened leaves, and each pair is counted once.
+ */
+typedef struct Diagnostics {
+    double kinetic;
+    double potential;
+    double px;
+    double py;
+    double lz;          // angular momentum about the origin
+
+    void clear();
+    // adds body with velocity (vx, vy) and potential energy `potential`
+    void add(const Body &body, double vx, double vy, double potential);
+} Diagnostics;
+
+/**
+ * The --diagnostics file, one CSV line per diagnostic step. record() is
+ * collective: the sums of every rank are reduced onto rank 0, which
+ * writes them.
+ */
+class DiagnosticsLog {
+public:
+    explicit DiagnosticsLog(int rank);
+
+    // rank 0 only; false if the file cannot be written
+    bool open(const char *fileName);
+
+    void record(Diagnostics &diagnostics, int step, double time);
+
+private:
+    std::ofstream out;
+    int rank;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "distributed.h"
+#include "morton.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+static void displacements(std::vector<int> &counts, std::vector<int> &displs) {
+    displs.resize(counts.size());
+    int sum = 0;
+    for (unsigned int i = 0; i < counts.size(); i++) {
+        displs[i] = sum;
+        sum += counts[i];
+    }
+}
+
+/**
+ * Hands rank 0's bodies out in contiguous blocks. Only used to get started;
+ * partitionBodies moves them to their proper owners.
+ */
+void scatterBodies(std::vector<Body> &bodies, std::vector<Body> &local,
+        MPI_Datatype mpiBody, int rank, int size) {
+    int total = bodies.size();
+    MPI_Bcast(&total, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    std::vector<int> counts(size), displs;
+    for (int r = 0; r < size; r++) {
+        counts[r] = total / size + (r < total % size ? 1 : 0);
+    }
+    displacements(counts, displs);
+    local.resize(counts[rank]);
+    MPI_Scatterv(bodies.data(), counts.data(), displs.data(), mpiBody,
+            local.data(), counts[rank], mpiBody, 0, MPI_COMM_WORLD);
+}
+
+// Collects every rank's bodies on rank 0, sorted by index.
+void gatherBodies(std::vector<Body> &local, std::vector<Body> &bodies,
+        MPI_Datatype mpiBody, int rank, int size) {
+    int count = local.size();
+    std::vector<int> counts(size), displs;
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    displacements(counts, displs);
+    if (rank == 0) {
+        bodies.resize(displs[size - 1] + counts[size - 1]);
+    }
+    MPI_Gatherv(local.data(), count, mpiBody,
+            bodies.data(), counts.data(), displs.data(), mpiBody, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::sort(bodies.begin(), bodies.end(),
+                [](const Body &a, const Body &b) { return a.index < b.index; });
+    }
+}
+
+/**
+ * Replicated mode: every rank sends the bodies it just moved (at
+ * `indices`) and receives everyone else's in a single Allgatherv, which
+ * leaves all ranks with the same, fully updated `bodies`. Received bodies
+ * are put back in place through `slot` (body index -> position).
+ */
+void allgatherBodies(std::vector<Body> &bodies, std::vector<unsigned int> &indices,
+        std::vector<int> &slot, MPI_Datatype mpiBody, int size) {
+    int count = indices.size();
+    std::vector<int> counts(size), displs;
+    MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    displacements(counts, displs);
+
+    std::vector<Body> send(count);
+    for (int j = 0; j < count; j++) {
+        send[j] = bodies[indices[j]];
+    }
+    std::vector<Body> received(displs[size - 1] + counts[size - 1]);
+    MPI_Allgatherv(send.data(), count, mpiBody,
+            received.data(), counts.data(), displs.data(), mpiBody, MPI_COMM_WORLD);
+    for (unsigned int j = 0; j < received.size(); j++) {
+        bodies[slot[received[j].index]] = received[j];
+    }
+}
+
+/**
+ * Moves every body to the rank owning its stretch of the Morton curve.
+ * Ranks agree on the split through a global histogram of the top
+ * PARTITION_BITS key bits, cut into `size` runs of about equal weight.
+ * Bodies weigh 1, or with `balance` the interactions they needed last
+ * step (cost zones). Bodies outside the tree stay where they are. On
+ * return `local` is in no particular order.
+ */
+void partitionBodies(std::vector<Body> &local, Quadrant &bounds, bool balance,
+        MPI_Datatype mpiBody, int rank, int size) {
+    std::vector<uint64_t> keys;
+    int valid = sortByMorton(local, bounds, keys);
+
+    const int bins = 1 << PARTITION_BITS;
+    const int shift = 2 * MORTON_BITS - PARTITION_BITS;
+    std::vector<double> hist(bins, 0), globalHist(bins);
+    for (int i = 0; i < valid; i++) {
+        hist[keys[i] >> shift] += balance ? std::max(local[i].cost, 1) : 1;
+    }
+    MPI_Allreduce(hist.data(), globalHist.data(), bins, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    double total = 0;
+    for (int b = 0; b < bins; b++) {
+        total += globalHist[b];
+    }
+    std::vector<int> owner(bins);
+    double before = 0;
+    for (int b = 0; b < bins; b++) {
+        owner[b] = total > 0 ? std::min(size - 1, (int)(before * size / total)) : 0;
+        before += globalHist[b];
+    }
+
+    // bodies are already in key order, so each destination is one run
+    std::vector<int> sendCounts(size, 0), recvCounts(size);
+    std::vector<Body> send;
+    send.reserve(local.size());
+    int i = 0;
+    for (int r = 0; r < size; r++) {
+        while (i < valid && owner[keys[i] >> shift] == r) {
+            send.push_back(local[i++]);
+            sendCounts[r]++;
+        }
+        if (r == rank) {
+            for (unsigned int j = valid; j < local.size(); j++) {
+                send.push_back(local[j]);
+                sendCounts[r]++;
+            }
+        }
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    std::vector<int> sendDispls, recvDispls;
+    displacements(sendCounts, sendDispls);
+    displacements(recvCounts, recvDispls);
+    local.resize(recvDispls[size - 1] + recvCounts[size - 1]);
+    MPI_Alltoallv(send.data(), sendCounts.data(), sendDispls.data(), mpiBody,
+            local.data(), recvCounts.data(), recvDispls.data(), mpiBody, MPI_COMM_WORLD);
+}
+
+/**
+ * Sends every other rank the part of `tree` it needs (its locally
+ * essential tree) and receives theirs. For each destination the tree is
+ * walked against that rank's bounding box: cells that pass the MAC from
+ * anywhere in the box go out as a single point mass, and leaves that do
+ * not go out body by body. What arrives is returned as massive bodies
+ * with index -1.
+ */
+void exchangeEssential(LinearTree &tree, double theta, std::vector<Body> &imported,
+        int rank, int size) {
+    const double inf = std::numeric_limits<double>::infinity();
+    double box[4] = {inf, -inf, inf, -inf};
+    BodyArrays &leaves = tree.leaves;
+    for (int b = 0; b < leaves.size(); b++) {
+        box[0] = std::min(box[0], leaves.x[b]);
+        box[1] = std::max(box[1], leaves.x[b]);
+        box[2] = std::min(box[2], leaves.y[b]);
+        box[3] = std::max(box[3], leaves.y[b]);
+    }
+    std::vector<double> boxes(4 * size);
+    MPI_Allgather(box, 4, MPI_DOUBLE, boxes.data(), 4, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    InteractionList send;
+    std::vector<int> sendCounts(size, 0), recvCounts(size);
+    for (int r = 0; r < size; r++) {
+        double *other = &boxes[4 * r];
+        if (r == rank || other[0] > other[1]) {
+            continue;
+        }
+        int before = send.x.size();
+        tree.addInteractions(other[0], other[1], other[2], other[3], theta, false, -1, send);
+        sendCounts[r] = send.x.size() - before;
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    // ship x, y and m as three doubles per point
+    int sendTotal = send.x.size();
+    std::vector<double> packed(3 * sendTotal);
+    for (int k = 0; k < sendTotal; k++) {
+        packed[3 * k] = send.x[k];
+        packed[3 * k + 1] = send.y[k];
+        packed[3 * k + 2] = send.m[k];
+    }
+    for (int r = 0; r < size; r++) {
+        sendCounts[r] *= 3;
+        recvCounts[r] *= 3;
+    }
+    std::vector<int> sendDispls, recvDispls;
+    displacements(sendCounts, sendDispls);
+    displacements(recvCounts, recvDispls);
+    int recvTotal = recvDispls[size - 1] + recvCounts[size - 1];
+    std::vector<double> received(recvTotal);
+    MPI_Alltoallv(packed.data(), sendCounts.data(), sendDispls.data(), MPI_DOUBLE,
+            received.data(), recvCounts.data(), recvDispls.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+    imported.resize(recvTotal / 3);
+    for (unsigned int k = 0; k < imported.size(); k++) {
+        Body &body = imported[k];
+        body.index = -1;
+        body.cost = 0;
+        body.x = received[3 * k];
+        body.y = received[3 * k + 1];
+        body.m = received[3 * k + 2];
+        body.vx = 0;
+        body.vy = 0;
+    }
+}
+
+// interactions the bodies in `indices` needed in their last walk
+double workOf(std::vector<Body> &bodies, std::vector<unsigned int> &indices) {
+    double work = 0;
+    for (unsigned int j = 0; j < indices.size(); j++) {
+        work += bodies[indices[j]].cost;
+    }
+    return work;
+}
+
+/**
+ * Prints how evenly the step's force work was spread, as the busiest
+ * rank's interaction count over the mean (1.0 is perfect balance).
+ * `work` is this rank's total over every pass of the step.
+ */
+void reportImbalance(double work, int step, int rank) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    double maxWork, totalWork;
+    MPI_Reduce(&work, &maxWork, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&work, &totalWork, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        double imbalance = totalWork > 0 ? maxWork / (totalWork / size) : 1.0;
+        std::cout << "step " << step << " imbalance " << imbalance << std::endl;
+    }
+}
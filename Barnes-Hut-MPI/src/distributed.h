@@ -0,0 +1,29 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+#include "quadrant.h"
+#include "lineartree.h"
+
+// leading bits of the Morton key used to place rank boundaries
+#define PARTITION_BITS 16
+
+void scatterBodies(std::vector<Body> &bodies, std::vector<Body> &local,
+        MPI_Datatype mpiBody, int rank, int size);
+void gatherBodies(std::vector<Body> &local, std::vector<Body> &bodies,
+        MPI_Datatype mpiBody, int rank, int size);
+
+void allgatherBodies(std::vector<Body> &bodies, std::vector<unsigned int> &indices,
+        std::vector<int> &slot, MPI_Datatype mpiBody, int size);
+
+void partitionBodies(std::vector<Body> &local, Quadrant &bounds, bool balance,
+        MPI_Datatype mpiBody, int rank, int size);
+double workOf(std::vector<Body> &bodies, std::vector<unsigned int> &indices);
+void reportImbalance(double work, int step, int rank);
+void exchangeEssential(LinearTree &tree, double theta, std::vector<Body> &imported,
+        int rank, int size);
+
+#endif
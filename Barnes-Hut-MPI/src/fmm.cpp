@@ -0,0 +1,437 @@
+#include "fmm.h"
+#include "kernels.h"
+
+#include <cmath>
+
+// position of the (a, b) coefficient, grouped by order a + b
+static inline int term(int a, int b) {
+    int n = a + b;
+    return n * (n + 1) / 2 + b;
+}
+
+FMM::FMM(int order) {
+    this->order = order;
+    terms = term(0, order) + 1;
+    tree = nullptr;
+    pairInteractions = 0;
+    cellInteractions = 0;
+    pairsVisited = 0;
+}
+
+bool FMM::isLeaf(int node) {
+    return tree->nodes[node].next == node + 1 || tree->nodes[node].count <= FMM_LEAF_SIZE;
+}
+
+/**
+ * derivatives[term(t, u)] = d^t/dx^t d^u/dy^u of 1/r at (x, y) for
+ * t + u <= maxOrder, through the McMurchie-Davidson recursion
+ *
+ *   R(n; 0, 0)     = (-1)^n (2n - 1)!! / r^(2n + 1)
+ *   R(n; t + 1, u) = t R(n + 1; t - 1, u) + x R(n + 1; t, u)
+ *
+ * (likewise for u), with the wanted derivatives at n = 0.
+ */
+void FMM::computeDerivatives(double x, double y, int maxOrder, int thread) {
+    int stride = term(0, maxOrder) + 1;
+    std::vector<double> &recursion = this->recursion[thread];
+    std::vector<double> &derivatives = this->derivatives[thread];
+    double r2 = x * x + y * y;
+    double inv2 = 1.0 / r2;
+    double base = 1.0 / sqrt(r2);
+    for (int n = 0; n <= maxOrder; n++) {
+        recursion[n * stride] = base;
+        base *= -(2 * n + 1) * inv2;
+    }
+    for (int level = 1; level <= maxOrder; level++) {
+        for (int n = 0; n + level <= maxOrder; n++) {
+            double *out = &recursion[n * stride];
+            const double *in = &recursion[(n + 1) * stride];
+            for (int u = 0; u <= level; u++) {
+                int t = level - u;
+                double value;
+                if (t > 0) {
+                    value = x * in[term(t - 1, u)];
+                    if (t > 1) {
+                        value += (t - 1) * in[term(t - 2, u)];
+                    }
+                } else {
+                    value = y * in[term(0, u - 1)];
+                    if (u > 1) {
+                        value += (u - 1) * in[term(0, u - 2)];
+                    }
+                }
+                out[term(t, u)] = value;
+            }
+        }
+    }
+    for (int k = 0; k < stride; k++) {
+        derivatives[k] = recursion[k];
+    }
+}
+
+// splits the cells the FMM uses, root down to its leaves, into levels
+void FMM::findLevels() {
+    levels.clear();
+    parent.assign(tree->nodes.size(), -1);
+    std::vector<int> depth(tree->nodes.size(), 0);
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+        if ((int)levels.size() <= depth[node]) {
+            levels.resize(depth[node] + 1);
+        }
+        levels[depth[node]].push_back(node);
+        if (isLeaf(node)) {
+            continue;
+        }
+        for (int c = node + 1; c < tree->nodes[node].next; c = tree->nodes[c].next) {
+            parent[c] = node;
+            depth[c] = depth[node] + 1;
+            stack.push_back(c);
+        }
+    }
+}
+
+// P2M at a leaf, M2M from its children, which are done, for any other cell
+void FMM::upward(int node, int thread) {
+    const LinearNode &cell = tree->nodes[node];
+    double *mp = &multipoles[node * terms];
+    std::vector<double> px(order + 1), py(order + 1);
+    if (isLeaf(node)) {
+        for (int b = cell.first; b < cell.first + cell.count; b++) {
+            double dx = tree->leaves.x[b] - cell.x;
+            double dy = tree->leaves.y[b] - cell.y;
+            px[0] = tree->leaves.m[b];
+            py[0] = 1.0;
+            for (int k = 1; k <= order; k++) {
+                px[k] = px[k - 1] * dx / k;
+                py[k] = py[k - 1] * dy / k;
+            }
+            for (int n = 0; n <= order; n++) {
+                for (int j = 0; j <= n; j++) {
+                    mp[term(n - j, j)] += px[n - j] * py[j];
+                }
+            }
+        }
+        return;
+    }
+    for (int c = node + 1; c < cell.next; c = tree->nodes[c].next) {
+        const LinearNode &child = tree->nodes[c];
+        const double *mc = &multipoles[c * terms];
+        double dx = child.x - cell.x;
+        double dy = child.y - cell.y;
+        px[0] = py[0] = 1.0;
+        for (int k = 1; k <= order; k++) {
+            px[k] = px[k - 1] * dx / k;
+            py[k] = py[k - 1] * dy / k;
+        }
+        for (int n = 0; n <= order; n++) {
+            for (int j = 0; j <= n; j++) {
+                int i = n - j;
+                double sum = 0;
+                for (int a = 0; a <= i; a++) {
+                    for (int b = 0; b <= j; b++) {
+                        sum += mc[term(a, b)] * px[i - a] * py[j - b];
+                    }
+                }
+                mp[term(i, j)] += sum;
+            }
+        }
+    }
+}
+
+// M2L from one well separated cell into another's local expansion
+void FMM::translate(int source, int target, int thread) {
+    const LinearNode &s = tree->nodes[source];
+    const LinearNode &t = tree->nodes[target];
+    computeDerivatives(t.x - s.x, t.y - s.y, 2 * order, thread);
+    const double *d = derivatives[thread].data();
+    const double *ms = &multipoles[source * terms];
+    double *lt = &locals[target * terms];
+    for (int n = 0; n <= order; n++) {
+        for (int j = 0; j <= n; j++) {
+            int i = n - j;
+            double toTarget = 0;
+            for (int k = 0; k <= order; k++) {
+                double sign = (k & 1) ? -1.0 : 1.0;
+                for (int b = 0; b <= k; b++) {
+                    toTarget += sign * ms[term(k - b, b)] * d[term(i + k - b, j + b)];
+                }
+            }
+            lt[term(i, j)] -= G * toTarget;
+        }
+    }
+    cells[thread]++;
+}
+
+// P2P from the bodies of one leaf onto those of another, or of itself
+void FMM::direct(int source, int target, int thread) {
+    const LinearNode &ns = tree->nodes[source];
+    const LinearNode &nt = tree->nodes[target];
+    const double *x = tree->leaves.x.data();
+    const double *y = tree->leaves.y.data();
+    const double *m = tree->leaves.m.data();
+    // a body meets itself at distance 0, which adds exactly 0
+    for (int k = nt.first; k < nt.first + nt.count; k++) {
+        accumulateAccel(x[k], y[k], x + ns.first, y + ns.first, m + ns.first, ns.count, ax[k], ay[k]);
+        for (int s = ns.first; s < ns.first + ns.count && !energy.empty(); s++) {
+            // unlike the force, a body's own term is not 0
+            if (s != k) {
+                double dx = x[s] - x[k];
+                double dy = y[s] - y[k];
+                energy[k] += calcPotential(m[k], m[s], sqrt(dx * dx + dy * dy));
+            }
+        }
+    }
+    pairs[thread] += (long) nt.count * ns.count;
+}
+
+// stable counting sort of (target, source) pairs into a run of sources per target
+static void groupByTarget(const std::vector<std::pair<int, int>> &pairs, int nodes,
+        std::vector<int> &start, std::vector<int> &sources) {
+    start.assign(nodes + 1, 0);
+    for (unsigned int k = 0; k < pairs.size(); k++) {
+        start[pairs[k].first + 1]++;
+    }
+    for (int k = 0; k < nodes; k++) {
+        start[k + 1] += start[k];
+    }
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    sources.resize(pairs.size());
+    for (unsigned int k = 0; k < pairs.size(); k++) {
+        sources[fill[pairs[k].first]++] = pairs[k].second;
+    }
+}
+
+/**
+ * Dual tree walk from (root, root). A pair of distinct cells is accepted
+ * when (reachA + reachB) < theta * d and no two of their bodies can be
+ * within rLimit of each other; otherwise the larger cell is split, until
+ * both are leaves and interact directly. A cell paired with itself turns
+ * into all pairs of its children. Fills in far and near for the needed
+ * targets, each in walk order.
+ */
+void FMM::walk(double theta) {
+    std::vector<std::pair<int, int>> farPairs;
+    std::vector<std::pair<int, int>> nearPairs;
+    // both directions of a pair, as far as anyone wants the target
+    auto both = [this](std::vector<std::pair<int, int>> &list, int a, int b) {
+        if (needed[b]) {
+            list.push_back(std::make_pair(b, a));
+        }
+        if (needed[a]) {
+            list.push_back(std::make_pair(a, b));
+        }
+    };
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back(std::make_pair(0, 0));
+    while (!stack.empty()) {
+        int a = stack.back().first;
+        int b = stack.back().second;
+        stack.pop_back();
+        pairsVisited++;
+        const LinearNode &na = tree->nodes[a];
+        const LinearNode &nb = tree->nodes[b];
+        bool leafA = isLeaf(a);
+        bool leafB = isLeaf(b);
+
+        if (a == b) {
+            if (leafA) {
+                if (needed[a]) {
+                    nearPairs.push_back(std::make_pair(a, a));
+                }
+                continue;
+            }
+            for (int c = a + 1; c < na.next; c = tree->nodes[c].next) {
+                stack.push_back(std::make_pair(c, c));
+                for (int e = tree->nodes[c].next; e < na.next; e = tree->nodes[e].next) {
+                    stack.push_back(std::make_pair(c, e));
+                }
+            }
+            continue;
+        }
+
+        double dx = na.x - nb.x;
+        double dy = na.y - nb.y;
+        double d = sqrt(dx * dx + dy * dy);
+        double reach = na.reach + nb.reach;
+        if (reach < theta * d && d - reach > rLimit) {
+            both(farPairs, a, b);
+            continue;
+        }
+        if (leafA && leafB) {
+            both(nearPairs, a, b);
+            continue;
+        }
+        bool splitA = leafB || (!leafA && na.reach >= nb.reach);
+        int split = splitA ? a : b;
+        int other = splitA ? b : a;
+        for (int c = split + 1; c < tree->nodes[split].next; c = tree->nodes[c].next) {
+            stack.push_back(std::make_pair(c, other));
+        }
+    }
+    groupByTarget(farPairs, tree->nodes.size(), farStart, far);
+    groupByTarget(nearPairs, tree->nodes.size(), nearStart, near);
+}
+
+// L2L from the parent, which is done, then L2P if the cell is a leaf
+void FMM::downward(int node) {
+    const LinearNode &cell = tree->nodes[node];
+    double *lp = &locals[node * terms];
+    std::vector<double> px(order + 1), py(order + 1);
+    if (parent[node] >= 0) {
+        const LinearNode &above = tree->nodes[parent[node]];
+        const double *la = &locals[parent[node] * terms];
+        double dx = cell.x - above.x;
+        double dy = cell.y - above.y;
+        px[0] = py[0] = 1.0;
+        for (int k = 1; k <= order; k++) {
+            px[k] = px[k - 1] * dx / k;
+            py[k] = py[k - 1] * dy / k;
+        }
+        for (int n = 0; n <= order; n++) {
+            for (int j = 0; j <= n; j++) {
+                int i = n - j;
+                double sum = 0;
+                for (int a = i; a <= order; a++) {
+                    for (int b = j; a + b <= order; b++) {
+                        sum += la[term(a, b)] * px[a - i] * py[b - j];
+                    }
+                }
+                lp[term(i, j)] += sum;
+            }
+        }
+    }
+    if (!isLeaf(node)) {
+        return;
+    }
+    for (int b = cell.first; b < cell.first + cell.count; b++) {
+        double dx = tree->leaves.x[b] - cell.x;
+        double dy = tree->leaves.y[b] - cell.y;
+        px[0] = py[0] = 1.0;
+        for (int k = 1; k <= order; k++) {
+            px[k] = px[k - 1] * dx / k;
+            py[k] = py[k - 1] * dy / k;
+        }
+        // a = -grad phi
+        double sumX = 0, sumY = 0;
+        for (int n = 0; n < order; n++) {
+            for (int j = 0; j <= n; j++) {
+                double p = px[n - j] * py[j];
+                sumX += lp[term(n - j + 1, j)] * p;
+                sumY += lp[term(n - j, j + 1)] * p;
+            }
+        }
+        ax[b] -= sumX;
+        ay[b] -= sumY;
+        if (!energy.empty()) {
+            double phi = 0;
+            for (int n = 0; n <= order; n++) {
+                for (int j = 0; j <= n; j++) {
+                    phi += lp[term(n - j, j)] * px[n - j] * py[j];
+                }
+            }
+            energy[b] += tree->leaves.m[b] * phi;
+        }
+    }
+}
+
+/**
+ * Fills forces (indexed like tree.leaves) with the pull of every other
+ * body in the tree, to within the truncation of the expansions. Only the
+ * bodies marked in wanted (all of them when it is null) get a force; the
+ * others are left at 0 and the cells holding none of them are skipped.
+ * The passes run level by level, and the interactions target by target,
+ * over pool, so the result does not depend on its size. With potentials
+ * the same direct sums and local expansions also give each body's
+ * potential energy.
+ */
+void FMM::calcForces(LinearTree &tree, double theta, ThreadPool &pool, const std::vector<char> *wanted,
+        std::vector<std::pair<double, double>> &forces, std::vector<double> *potentials) {
+    this->tree = &tree;
+    int n = tree.leaves.size();
+    forces.assign(n, std::make_pair(0.0, 0.0));
+    if (potentials != nullptr) {
+        potentials->assign(n, 0.0);
+    }
+    pairInteractions = 0;
+    cellInteractions = 0;
+    pairsVisited = 0;
+    if (tree.nodes.empty()) {
+        return;
+    }
+    int nodes = tree.nodes.size();
+    multipoles.assign(nodes * terms, 0.0);
+    locals.assign(nodes * terms, 0.0);
+    ax.assign(n, 0.0);
+    ay.assign(n, 0.0);
+    energy.assign(potentials != nullptr ? n : 0, 0.0);
+    int stride = term(0, 2 * order) + 1;
+    recursion.assign(pool.size(), std::vector<double>((2 * order + 1) * stride));
+    derivatives.assign(pool.size(), std::vector<double>(stride));
+    cells.assign(pool.size(), 0);
+    pairs.assign(pool.size(), 0);
+
+    // a cell is needed when it holds a wanted body
+    std::vector<int> before(n + 1, 0);
+    for (int b = 0; b < n; b++) {
+        before[b + 1] = before[b] + (wanted == nullptr || (*wanted)[b]);
+    }
+    needed.resize(nodes);
+    for (int c = 0; c < nodes; c++) {
+        needed[c] = before[tree.nodes[c].first + tree.nodes[c].count] > before[tree.nodes[c].first];
+    }
+
+    findLevels();
+    for (int depth = levels.size() - 1; depth >= 0; depth--) {
+        const std::vector<int> &level = levels[depth];
+        pool.parallelFor(level.size(), 16, [&](int k, int thread) {
+            upward(level[k], thread);
+        });
+    }
+
+    walk(theta);
+    std::vector<int> targets;
+    for (int c = 0; c < nodes; c++) {
+        if (farStart[c] < farStart[c + 1] || nearStart[c] < nearStart[c + 1]) {
+            targets.push_back(c);
+        }
+    }
+    pool.parallelFor(targets.size(), 1, [&](int k, int thread) {
+        int target = targets[k];
+        for (int f = farStart[target]; f < farStart[target + 1]; f++) {
+            translate(far[f], target, thread);
+        }
+        for (int f = nearStart[target]; f < nearStart[target + 1]; f++) {
+            direct(near[f], target, thread);
+        }
+    });
+
+    for (unsigned int depth = 0; depth < levels.size(); depth++) {
+        std::vector<int> level;
+        for (int c : levels[depth]) {
+            if (needed[c]) {
+                level.push_back(c);
+            }
+        }
+        pool.parallelFor(level.size(), 16, [&](int k, int thread) {
+            downward(level[k]);
+        });
+    }
+
+    for (unsigned int t = 0; t < cells.size(); t++) {
+        cellInteractions += cells[t];
+        pairInteractions += pairs[t];
+    }
+    for (int b = 0; b < n; b++) {
+        if (wanted != nullptr && !(*wanted)[b]) {
+            continue;
+        }
+        forces[b].first = tree.leaves.m[b] * ax[b];
+        forces[b].second = tree.leaves.m[b] * ay[b];
+        if (potentials != nullptr) {
+            (*potentials)[b] = energy[b];
+        }
+    }
+}
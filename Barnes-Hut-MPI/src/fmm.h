@@ -0,0 +1,89 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <utility>
+#include <vector>
+
+#include "lineartree.h"
+#include "threadpool.h"
+
+// cells with at most this many bodies are not split further by the FMM
+#define FMM_LEAF_SIZE 64
+
+/**
+ * Fast multipole evaluation over a LinearTree, O(N) per step.
+ *
+ * Every cell gets a Cartesian multipole expansion of its bodies about its
+ * centre of mass, M[a,b] = sum m dx^a dy^b / (a! b!) for a + b <= order,
+ * built bottom up (P2M, M2M). A dual tree walk then pairs cells off:
+ * pairs that are far enough apart exchange multipole-to-local
+ * translations (M2L), pairs of small cells interact body by body (P2P),
+ * and anything else is split. Local expansions are pushed down (L2L) and
+ * evaluated at the bodies (L2P).
+ *
+ * The walk only lists the pairs. Each interaction is then carried out
+ * once per target cell, which only ever writes its own expansion or
+ * bodies, so the passes are spread over a ThreadPool one tree level or
+ * one target at a time, in an order that does not depend on the threads.
+ * Targets that hold none of the wanted bodies are skipped, which is how
+ * each rank only pays for its own share.
+ *
+ * The derivatives of 1/r that every translation needs come from the
+ * McMurchie-Davidson recursion. The expansions assume the plain inverse
+ * square law, so a pair of cells that could hold two bodies within rLimit
+ * of each other is split down to direct sums instead.
+ */
+class FMM {
+public:
+    explicit FMM(int order);
+
+    // forces on the leaf bodies marked in `wanted`, or on all of them
+    // without it, indexed like tree.leaves; the rest are left at 0. Pairs
+    // of cells are accepted once (reachA + reachB) < theta * distance.
+    // potentials, if given, get the same bodies' potential energies
+    void calcForces(LinearTree &tree, double theta, ThreadPool &pool, const std::vector<char> *wanted,
+            std::vector<std::pair<double, double>> &forces, std::vector<double> *potentials = nullptr);
+
+    // what the last calcForces did
+    long pairInteractions;
+    long cellInteractions;
+    long pairsVisited;
+
+private:
+    int order;
+    int terms;
+    LinearTree *tree;
+    std::vector<double> multipoles;
+    std::vector<double> locals;
+    std::vector<double> ax;
+    std::vector<double> ay;
+    // potential energy per leaf body, empty unless asked for
+    std::vector<double> energy;
+    // the cells down to the FMM leaves, by depth, and each one's parent
+    std::vector<std::vector<int>> levels;
+    std::vector<int> parent;
+    // whether a cell holds a wanted body
+    std::vector<char> needed;
+    // per target cell, the cells it translates from and the leaves it
+    // sums directly, as runs of far/near starting at farStart/nearStart
+    std::vector<int> farStart;
+    std::vector<int> far;
+    std::vector<int> nearStart;
+    std::vector<int> near;
+    // derivative tables and counters, one set per thread
+    std::vector<std::vector<double>> recursion;
+    std::vector<std::vector<double>> derivatives;
+    std::vector<long> cells;
+    std::vector<long> pairs;
+
+    bool isLeaf(int node);
+    void findLevels();
+    void upward(int node, int thread);
+    void downward(int node);
+    void walk(double theta);
+    void translate(int source, int target, int thread);
+    void direct(int source, int target, int thread);
+    void computeDerivatives(double x, double y, int maxOrder, int thread);
+};
+
+#endif
@@ -6,4 +6,16 @@
  */ 
 bool checkMAC (double s, double d, double theta) {
     return (s / d) < theta;
+}
+
+/**
+ * True unless a cell whose bodies are all within `reach` of its centre of
+ * mass may have bodies on both sides of rLimit from targets `nearest` to
+ * `furthest` away from that centre.
+ * Multipole terms past the monopole only hold for cells that pass this as
+ * well: outside rLimit the law is the plain inverse square, inside it is
+ * linear in the distance and the monopole alone is exact.
+ */
+bool clearOfSoftening (double reach, double nearest, double furthest) {
+    return nearest - reach > rLimit || furthest + reach < rLimit;
 }
\ No newline at end of file
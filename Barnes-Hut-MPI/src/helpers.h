@@ -7,6 +7,18 @@
 #include "body.h"
 
 bool checkMAC (double s, double d, double theta);
+bool clearOfSoftening (double reach, double nearest, double furthest);
+
+/**
+ * What force walks did, for --profile: nodes looked at, cells taken whole
+ * by the MAC and body-body (leaf) interactions. A walk given one adds to
+ * it, so each thread keeps its own.
+ */
+typedef struct WalkCounts {
+    long visited;
+    long accepted;
+    long leaf;
+} WalkCounts;
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "integrator.h"
+
+#include <cstring>
+
+int integratorFromName(const char *name) {
+    const char *names[] = { "taylor", "leapfrog", "yoshida" };
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Integrator::Integrator(int scheme) : taylor(scheme == INTEGRATOR_TAYLOR) {
+    if (scheme == INTEGRATOR_LEAPFROG) {
+        drifts = { 0.5, 0.5 };
+        kicks = { 1.0 };
+    } else if (scheme == INTEGRATOR_YOSHIDA) {
+        double cbrt2 = cbrt(2.0);
+        double w1 = 1.0 / (2.0 - cbrt2);
+        double w0 = -cbrt2 / (2.0 - cbrt2);
+        drifts = { w1 / 2, (w0 + w1) / 2, (w0 + w1) / 2, w1 / 2 };
+        kicks = { w1, w0, w1 };
+    }
+}
+
+int Integrator::stages() {
+    return taylor ? 1 : kicks.size();
+}
+
+void Integrator::begin(Body &body, double dt) {
+    if (taylor) {
+        return;
+    }
+    body.x += drifts[0] * dt * body.vx;
+    body.y += drifts[0] * dt * body.vy;
+}
+
+void Integrator::velocityAt(const Body &body, int stage, double dt, double fx, double fy,
+        double &vx, double &vy) {
+    vx = body.vx;
+    vy = body.vy;
+    if (!taylor) {
+        // positions sit half way through the kick
+        vx += 0.5 * kicks[stage] * dt * fx / body.m;
+        vy += 0.5 * kicks[stage] * dt * fy / body.m;
+    }
+}
+
+void Integrator::update(Body &body, int stage, double dt, double fx, double fy) {
+    if (taylor) {
+        calcNewPos(&body, dt, fx, fy);
+        return;
+    }
+    body.vx += kicks[stage] * dt * fx / body.m;
+    body.vy += kicks[stage] * dt * fy / body.m;
+    body.x += drifts[stage + 1] * dt * body.vx;
+    body.y += drifts[stage + 1] * dt * body.vy;
+}
@@ -0,0 +1,53 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <vector>
+
+#include "body.h"
+
+// schemes for --integrator, broadcast as ints
+enum {
+    INTEGRATOR_TAYLOR = 0,
+    INTEGRATOR_LEAPFROG,
+    INTEGRATOR_YOSHIDA
+};
+
+// the scheme called name, or -1 if there is none
+int integratorFromName(const char *name);
+
+/**
+ * How bodies move from the forces of one step. A step takes stages()
+ * force evaluations: begin() runs on every body before the first one,
+ * and update() on each body given the force of evaluation `stage`.
+ *
+ *  - taylor: calcNewPos, one evaluation, the default.
+ *  - leapfrog: drift dt/2, kick dt, drift dt/2. Symplectic and second
+ *    order for one evaluation per step.
+ *  - yoshida: three leapfrogs of w1 dt, w0 dt, w1 dt with the drifts in
+ *    between merged, fourth order for three evaluations per step.
+ *
+ * Every scheme leaves positions and velocities at the same time after a
+ * step, so checkpoints and output look the same whichever one ran.
+ */
+class Integrator {
+public:
+    Integrator(int scheme);
+
+    int stages();
+
+    void begin(Body &body, double dt);
+
+    void update(Body &body, int stage, double dt, double fx, double fy);
+
+    // body's velocity at the time of evaluation `stage`, which update() moves past
+    void velocityAt(const Body &body, int stage, double dt, double fx, double fy,
+            double &vx, double &vy);
+
+private:
+    bool taylor;
+    // drift i comes before kick i, with one more drift after the last kick
+    std::vector<double> drifts;
+    std::vector<double> kicks;
+};
+
+#endif
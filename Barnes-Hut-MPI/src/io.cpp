@@ -1,41 +1,229 @@
 #include "io.h"
 #include "vector"
 
-void readFile(const char* fileName, options_t *options, std::vector<Body> &bodies){
-    std::ifstream input;
+#include <cctype>
+#include <cstddef>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-    input.open(fileName);
+static_assert(sizeof(Body) == 48, "binary body records are 48 bytes");
+
+// text is read and written through buffers of this many bytes
+#define TEXT_CHUNK (1 << 20)
+
+BodyFileHeader makeHeader(uint64_t count, int64_t step, double dt, double theta) {
+    BodyFileHeader header = {};
+    memcpy(header.magic, BODY_FILE_MAGIC, sizeof(header.magic));
+    header.version = BODY_FILE_VERSION;
+    header.headerSize = sizeof(BodyFileHeader);
+    header.recordSize = sizeof(Body);
+    header.count = count;
+    header.step = step;
+    header.dt = dt;
+    header.theta = theta;
+    return header;
+}
+
+bool readHeader(const char *fileName, BodyFileHeader &header) {
+    std::ifstream input(fileName, std::ifstream::binary);
+    header = {};
+    input.read((char *)&header, offsetof(BodyFileHeader, step));
+    if (!input || memcmp(header.magic, BODY_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        return false;
+    }
+    if (header.version >= 2) {
+        input.read((char *)&header.step, sizeof(header) - offsetof(BodyFileHeader, step));
+    }
+    return (bool)input;
+}
+
+bool validHeader(const BodyFileHeader &header, uint64_t recordSize, uint64_t length) {
+    // version 1 headers end where step begins
+    uint64_t fields = header.version >= 2 ? sizeof(BodyFileHeader) : offsetof(BodyFileHeader, step);
+    // count is compared by division so a huge one cannot wrap around
+    return memcmp(header.magic, BODY_FILE_MAGIC, sizeof(header.magic)) == 0
+            && header.version >= 1 && header.version <= BODY_FILE_VERSION
+            && header.recordSize == recordSize
+            && header.headerSize >= fields && header.headerSize <= length
+            && header.count <= (length - header.headerSize) / recordSize;
+}
+
+bool isBinaryFile(const char *fileName) {
+    std::ifstream input(fileName, std::ifstream::binary);
+    char magic[8];
+    if (!input.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return memcmp(magic, BODY_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool readFile(const char* fileName, options_t *options, std::vector<Body> &bodies){
+    if (isBinaryFile(fileName)) {
+        return readBinaryFile(fileName, bodies);
+    } else {
+        return readTextFile(fileName, bodies);
+    }
+}
+
+bool readTextBodies(const char *fileName, const std::function<void(long)> &start,
+        const std::function<const char *(const char *, const char *)> &parse) {
+    std::ifstream input(fileName, std::ifstream::binary);
     if (!input.is_open()) {
         std::cerr << "ERROR: Unable to open file" << std::endl; 
-        return;
+        return false;
     }
-    std::string line;
-    getline(input, line);
-    int numBodies = stoi(line);
+    // read in large chunks and parse whole lines in place; the partial
+    // line at the end of a chunk is moved to the front for the next one
+    std::vector<char> buffer(TEXT_CHUNK);
+    size_t kept = 0;
+    long numBodies = -1;
+    long read = 0;
+    bool done = false;
+    while (!done && (numBodies < 0 || read < numBodies)) {
+        if (kept == buffer.size()) {
+            buffer.resize(2 * buffer.size());
+        }
+        input.read(buffer.data() + kept, buffer.size() - kept);
+        size_t filled = kept + input.gcount();
+        done = filled < buffer.size();
+        const char *first = buffer.data();
+        const char *last = first + filled;
+        if (!done) {
+            while (last != first && last[-1] != '\n') {
+                last--;
+            }
+            if (last == first) {
+                kept = filled;
+                continue;
+            }
+        }
 
-    for (int i = 0; i < numBodies; i++){
-        getline(input, line);
-        Body temp;
-        getFromString(temp, line);
-        bodies.push_back(temp);
+        if (numBodies < 0) {
+            while (first != last && isspace(*first)) {
+                first++;
+            }
+            std::from_chars_result res = std::from_chars(first, last, numBodies);
+            if (res.ec != std::errc() || numBodies < 0 || endOfLine(res.ptr, last) == nullptr) {
+                std::cerr << "ERROR: Missing body count" << std::endl;
+                return false;
+            }
+            first = endOfLine(res.ptr, last);
+            start(numBodies);
+        }
+        while (read < numBodies) {
+            // blank lines are skipped here only; within a body a line break ends it
+            while (first != last && isspace(*first)) {
+                first++;
+            }
+            if (first == last) {
+                break;
+            }
+            first = parse(first, last);
+            if (first == nullptr) {
+                std::cerr << "ERROR: Bad body on line " << read + 2 << std::endl;
+                return false;
+            }
+            read++;
+        }
+
+        kept = buffer.data() + filled - first;
+        memmove(buffer.data(), first, kept);
+    }
+    if (read < numBodies) {
+        std::cerr << "ERROR: expected " << numBodies << " bodies, got " << read << std::endl;
+        return false;
     }
-    input.close();
+    return true;
+}
+
+bool readTextFile(const char *fileName, std::vector<Body> &bodies) {
+    return readTextBodies(fileName, [&](long count) { bodies.reserve(count); },
+            [&](const char *first, const char *last) {
+                Body temp;
+                first = parseBody(first, last, temp);
+                if (first != nullptr) {
+                    bodies.push_back(temp);
+                }
+                return first;
+            });
+}
+
+bool readBinaryFile(const char *fileName, std::vector<Body> &bodies) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "ERROR: Unable to open file" << std::endl;
+        return false;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size_t length = info.st_size;
+    void *map = length >= offsetof(BodyFileHeader, step)
+            ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "ERROR: Unable to map file" << std::endl;
+        return false;
+    }
+
+    const BodyFileHeader *header = (const BodyFileHeader *)map;
+    if (!validHeader(*header, sizeof(Body), length)) {
+        std::cerr << "ERROR: Unsupported or truncated body file" << std::endl;
+        munmap(map, length);
+        return false;
+    }
+    // the records are already Bodies, so loading is a single copy out of
+    // the page cache with nothing to parse
+    madvise(map, length, MADV_SEQUENTIAL);
+    const Body *records = (const Body *)((const char *)map + header->headerSize);
+    bodies.assign(records, records + header->count);
+    munmap(map, length);
+    return true;
 }
 
 void write_file(options_t *options, std::vector<Body> &bodies) {
-  // Open file
-	std::ofstream out;
-	out.open(options->outputFileName, std::ofstream::trunc);
-    unsigned int size = bodies.size();
-    out << size << "\n";
+    if (options->binary) {
+        writeBinaryFile(options->outputFileName, bodies,
+                options->steps, options->timeStep, options->theta);
+    } else {
+        writeTextFile(options->outputFileName, bodies);
+    }
+}
+
+void writeTextFile(const char *fileName, std::vector<Body> &bodies) {
+	std::ofstream out(fileName, std::ofstream::binary | std::ofstream::trunc);
+    std::vector<char> buffer(TEXT_CHUNK);
+    char *end = buffer.data() + buffer.size();
+    char *pos = std::to_chars(buffer.data(), end, bodies.size()).ptr;
+    *pos++ = '\n';
 
-	// Write solution to output file
+	// format into the buffer and only hand full chunks to the stream
 	for (unsigned int i = 0; i < bodies.size(); ++i) {
-		out << createLine(&bodies[i]);
+        if (end - pos < BODY_LINE_MAX) {
+            out.write(buffer.data(), pos - buffer.data());
+            pos = buffer.data();
+        }
+        pos = formatBody(pos, end, bodies[i]);
 	}
-
-	out.flush();
+    out.write(buffer.data(), pos - buffer.data());
 	out.close();
-	
-	// free(opts->output_vals);
+    if (!out) {
+        std::cerr << "ERROR: Unable to write " << fileName << std::endl;
+    }
+}
+
+void writeBinaryFile(const char *fileName, std::vector<Body> &bodies,
+        int64_t step, double dt, double theta) {
+    BodyFileHeader header = makeHeader(bodies.size(), step, dt, theta);
+
+    std::ofstream out(fileName, std::ofstream::binary | std::ofstream::trunc);
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)bodies.data(), bodies.size() * sizeof(Body));
+    out.close();
+    if (!out) {
+        std::cerr << "ERROR: Unable to write " << fileName << std::endl;
+    }
 }
@@ -5,14 +5,57 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <cstdint>
+#include <functional>
 #include "helpers.h"
 #include "body.h"
 
+/**
+ * Binary body files are this header followed by `count` Body records as
+ * they sit in memory (native byte order, 48 bytes each), starting at
+ * headerSize. Readers check magic, version and recordSize, and skip to
+ * headerSize, so later versions can append header fields.
+ */
+#define BODY_FILE_MAGIC "NBODYBIN"
+#define BODY_FILE_VERSION 2
 
-void readFile(const char* fileName, options_t *options, std::vector<Body> &bodies);
-void write_file(options_t *options, std::vector<Body> &bodies);
+struct BodyFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t count;
+    // version 2: the steps already taken, and the dt/theta they used, so
+    // a run can be restarted from the file
+    int64_t step;
+    double dt;
+    double theta;
+};
+
+BodyFileHeader makeHeader(uint64_t count, int64_t step = 0, double dt = 0, double theta = 0);
+// false if fileName isn't a binary body file; version 1 headers read as step 0
+bool readHeader(const char *fileName, BodyFileHeader &header);
+// false unless a file of `length` bytes holds the whole header and `count` records of recordSize
+bool validHeader(const BodyFileHeader &header, uint64_t recordSize, uint64_t length);
 
+bool isBinaryFile(const char *fileName);
 
+// picks the binary or the text reader from the file's first bytes; false,
+// after printing why, if the file is missing, malformed or truncated
+bool readFile(const char* fileName, options_t *options, std::vector<Body> &bodies);
+bool readTextFile(const char *fileName, std::vector<Body> &bodies);
+// the chunked reader behind readTextFile: start(count) gets the body count,
+// then parse(first, last) gets the text from each body's line on and returns
+// the end of that line, or nullptr if it is malformed
+bool readTextBodies(const char *fileName, const std::function<void(long)> &start,
+        const std::function<const char *(const char *, const char *)> &parse);
+bool readBinaryFile(const char *fileName, std::vector<Body> &bodies);
 
+// text unless -f was given
+void write_file(options_t *options, std::vector<Body> &bodies);
+void writeTextFile(const char *fileName, std::vector<Body> &bodies);
+void writeBinaryFile(const char *fileName, std::vector<Body> &bodies,
+        int64_t step = 0, double dt = 0, double theta = 0);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,164 @@
+#include "kernels.h"
+#include "body.h"
+
+#include <algorithm>
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+void addQuadrupole(double dx, double dy, double qxx, double qxy, double qyy,
+        double &ax, double &ay) {
+    // a = G (5/2 (d.Qd) d / r^7 - Qd / r^5), with d pointing at the cell,
+    // which must be clear of the rLimit softening (see clearOfSoftening).
+    // A cell within rLimit needs no correction.
+    double r2 = (dx * dx) + (dy * dy);
+    if (r2 < rLimit * rLimit) {
+        return;
+    }
+    double inv2 = 1.0 / r2;
+    double inv5 = inv2 * inv2 / sqrt(r2);
+    double qdx = qxx * dx + qxy * dy;
+    double qdy = qxy * dx + qyy * dy;
+    double outer = 2.5 * (dx * qdx + dy * qdy) * inv2;
+    ax += G * inv5 * (outer * dx - qdx);
+    ay += G * inv5 * (outer * dy - qdy);
+}
+
+void accumulateQuadrupole(double tx, double ty, const double *x, const double *y,
+        const double *qxx, const double *qxy, const double *qyy, int count,
+        double &ax, double &ay) {
+    for (int k = 0; k < count; k++) {
+        addQuadrupole(x[k] - tx, y[k] - ty, qxx[k], qxy[k], qyy[k], ax, ay);
+    }
+}
+
+static void accumulateScalar(double tx, double ty, const double *x, const double *y,
+        const double *m, int begin, int end, double &ax, double &ay) {
+    const double r2Limit = rLimit * rLimit;
+    double resX = 0, resY = 0;
+    for (int k = begin; k < end; k++) {
+        double xDiff = x[k] - tx;
+        double yDiff = y[k] - ty;
+        double r2 = std::max((xDiff * xDiff) + (yDiff * yDiff), r2Limit);
+        double inv = 1.0 / sqrt(r2);
+        double f = G * m[k] * inv * inv * inv;
+        resX += f * xDiff;
+        resY += f * yDiff;
+    }
+    ax += resX;
+    ay += resY;
+}
+
+void accumulateAccel3(double tx, double ty, double tz, const double *x, const double *y,
+        const double *z, const double *m, int count, double &ax, double &ay, double &az) {
+    const double r2Limit = rLimit * rLimit;
+    double resX = 0, resY = 0, resZ = 0;
+    for (int k = 0; k < count; k++) {
+        double xDiff = x[k] - tx;
+        double yDiff = y[k] - ty;
+        double zDiff = z[k] - tz;
+        double r2 = std::max((xDiff * xDiff) + (yDiff * yDiff) + (zDiff * zDiff), r2Limit);
+        double inv = 1.0 / sqrt(r2);
+        double f = G * m[k] * inv * inv * inv;
+        resX += f * xDiff;
+        resY += f * yDiff;
+        resZ += f * zDiff;
+    }
+    ax += resX;
+    ay += resY;
+    az += resZ;
+}
+
+#if defined(__AVX512F__)
+
+// GCC's own headers build _mm512_undefined_pd from a self-initialised
+// variable, which trips -Wuninitialized once the intrinsics are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+void accumulateAccel(double tx, double ty, const double *x, const double *y, const double *m,
+        int count, double &ax, double &ay) {
+    const __m512d px = _mm512_set1_pd(tx);
+    const __m512d py = _mm512_set1_pd(ty);
+    const __m512d limit = _mm512_set1_pd(rLimit * rLimit);
+    const __m512d g = _mm512_set1_pd(G);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d threeHalves = _mm512_set1_pd(1.5);
+    __m512d sumX = _mm512_setzero_pd();
+    __m512d sumY = _mm512_setzero_pd();
+
+    int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + k), px);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + k), py);
+        __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+        r2 = _mm512_max_pd(r2, limit);
+        // 14 bit estimate, two Newton steps take it past double precision
+        __m512d inv = _mm512_rsqrt14_pd(r2);
+        __m512d hr2 = _mm512_mul_pd(half, r2);
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(hr2, _mm512_mul_pd(inv, inv), threeHalves));
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(hr2, _mm512_mul_pd(inv, inv), threeHalves));
+        __m512d inv3 = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+        __m512d f = _mm512_mul_pd(_mm512_mul_pd(g, _mm512_loadu_pd(m + k)), inv3);
+        sumX = _mm512_fmadd_pd(f, dx, sumX);
+        sumY = _mm512_fmadd_pd(f, dy, sumY);
+    }
+    ax += _mm512_reduce_add_pd(sumX);
+    ay += _mm512_reduce_add_pd(sumY);
+    accumulateScalar(tx, ty, x, y, m, k, count, ax, ay);
+}
+
+#pragma GCC diagnostic pop
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+static double horizontalSum(__m256d v) {
+    __m128d low = _mm256_castpd256_pd128(v);
+    __m128d high = _mm256_extractf128_pd(v, 1);
+    low = _mm_add_pd(low, high);
+    return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+void accumulateAccel(double tx, double ty, const double *x, const double *y, const double *m,
+        int count, double &ax, double &ay) {
+    const __m256d px = _mm256_set1_pd(tx);
+    const __m256d py = _mm256_set1_pd(ty);
+    const __m256d limit = _mm256_set1_pd(rLimit * rLimit);
+    const __m256d g = _mm256_set1_pd(G);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d threeHalves = _mm256_set1_pd(1.5);
+    __m256d sumX = _mm256_setzero_pd();
+    __m256d sumY = _mm256_setzero_pd();
+
+    int k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + k), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + k), py);
+        __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+        r2 = _mm256_max_pd(r2, limit);
+        // AVX2 only has a single precision estimate (12 bits), three
+        // Newton steps in double bring it to full precision
+        __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+        __m256d hr2 = _mm256_mul_pd(half, r2);
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), threeHalves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), threeHalves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), threeHalves));
+        __m256d inv3 = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+        __m256d f = _mm256_mul_pd(_mm256_mul_pd(g, _mm256_loadu_pd(m + k)), inv3);
+        sumX = _mm256_fmadd_pd(f, dx, sumX);
+        sumY = _mm256_fmadd_pd(f, dy, sumY);
+    }
+    ax += horizontalSum(sumX);
+    ay += horizontalSum(sumY);
+    accumulateScalar(tx, ty, x, y, m, k, count, ax, ay);
+}
+
+#else
+
+void accumulateAccel(double tx, double ty, const double *x, const double *y, const double *m,
+        int count, double &ax, double &ay) {
+    accumulateScalar(tx, ty, x, y, m, 0, count, ax, ay);
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/**
+ * Pull of `count` point masses at (x[k], y[k]) with mass m[k] on a unit
+ * mass at (tx, ty), added into ax and ay. It uses the same law as calcDimF
+ * (G and rLimit from body.h), so multiplying by the target's mass gives
+ * the force.
+ *
+ * Depending on the instruction set the file is compiled for, sources are
+ * taken 8 (AVX-512) or 4 (AVX2) at a time. 1/r comes from the hardware
+ * reciprocal square root estimate plus Newton steps, and the rLimit cap
+ * is a max on r^2, so there are no branches. Other targets get the plain
+ * scalar loop.
+ */
+void accumulateAccel(double tx, double ty, const double *x, const double *y, const double *m,
+        int count, double &ax, double &ay);
+
+// accumulateAccel in three dimensions, as a plain loop
+void accumulateAccel3(double tx, double ty, double tz, const double *x, const double *y,
+        const double *z, const double *m, int count, double &ax, double &ay, double &az);
+
+/**
+ * Quadrupole correction to the pull of a cell with centre of mass
+ * (tx + dx, ty + dy) on a unit mass at (tx, ty), added into ax and ay.
+ * The cell's monopole part goes through calcDimF or accumulateAccel as
+ * before. qxx, qxy and qyy are its traceless moments about the centre of
+ * mass, sum m (2 dx^2 - dy^2), sum 3 m dx dy and sum m (2 dy^2 - dx^2).
+ * The expansion assumes the plain inverse square law, so the cell must
+ * pass clearOfSoftening (helpers.h).
+ */
+void addQuadrupole(double dx, double dy, double qxx, double qxy, double qyy,
+        double &ax, double &ay);
+
+// addQuadrupole for `count` cells at (x[k], y[k])
+void accumulateQuadrupole(double tx, double ty, const double *x, const double *y,
+        const double *qxx, const double *qxy, const double *qyy, int count,
+        double &ax, double &ay);
+
+#endif
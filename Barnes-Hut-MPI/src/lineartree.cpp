@@ -0,0 +1,429 @@
+#include "lineartree.h"
+#include "kernels.h"
+
+#include <algorithm>
+
+void InteractionList::clear() {
+    x.clear();
+    y.clear();
+    m.clear();
+    qx.clear();
+    qy.clear();
+    qxx.clear();
+    qxy.clear();
+    qyy.clear();
+    own = -1;
+}
+
+void InteractionList::add(double px, double py, double pm) {
+    x.push_back(px);
+    y.push_back(py);
+    m.push_back(pm);
+}
+
+void InteractionList::addQuadrupole(const LinearNode &node) {
+    qx.push_back(node.x);
+    qy.push_back(node.y);
+    qxx.push_back(node.qxx);
+    qxy.push_back(node.qxy);
+    qyy.push_back(node.qyy);
+}
+
+void LinearTree::clear() {
+    nodes.clear();
+    leaves.clear();
+    source.clear();
+}
+
+int LinearTree::size() {
+    return nodes.size();
+}
+
+// base is the start of the vector the tree's bodies were inserted from
+void LinearTree::build(QuadTree *root, Body *base) {
+    clear();
+    flatten(root, base);
+}
+
+void LinearTree::flatten(QuadTree *node, Body *base) {
+    if (node == nullptr || node->getBodyCount() == 0) {
+        return;
+    }
+    int current = nodes.size();
+    Quadrant *quadrant = node->getQuadrant();
+    Body *body = node->getBody();
+
+    LinearNode temp;
+    temp.x = body->x;
+    temp.y = body->y;
+    temp.m = body->m;
+    temp.cx = quadrant->getXHalfway();
+    temp.cy = quadrant->getYHalfway();
+    temp.halfWidth = (quadrant->getXMax() - quadrant->getXMin()) / 2;
+    temp.qxx = node->qxx;
+    temp.qxy = node->qxy;
+    temp.qyy = node->qyy;
+    temp.reach = node->reach;
+    temp.first = leaves.size();
+    temp.count = node->getBodyCount();
+    nodes.push_back(temp);
+
+    if (node->getBodyCount() == 1) {
+        leaves.push(*body);
+        source.push_back(body - base);
+    } else if (node->bucket != nullptr) {
+        for (int k = 0; k < node->bodyCount; k++) {
+            leaves.push(*node->bucket->bodies[k]);
+            source.push_back(node->bucket->bodies[k] - base);
+        }
+    } else {
+        // same child order as QuadTree::calcForceOn
+        flatten(node->getBotLeft(), base);
+        flatten(node->getBotRight(), base);
+        flatten(node->getTopLeft(), base);
+        flatten(node->getTopRight(), base);
+    }
+    nodes[current].next = nodes.size();
+}
+
+/**
+ * Builds the tree from the first `count` bodies, which must already be in
+ * Morton order with their keys in `keys` (see sortByMorton). Each subtree
+ * is a contiguous key range, so cells are split by searching for where the
+ * next two-bit digit changes and mass is summed on the way back up.
+ */
+void LinearTree::buildSorted(std::vector<Body> &bodies, std::vector<uint64_t> &keys, int count, Quadrant &bounds,
+        int leafCapacity) {
+    clear();
+    this->leafCapacity = leafCapacity;
+    for (int i = 0; i < count; i++) {
+        leaves.push(bodies[i]);
+        source.push_back(i);
+    }
+    if (count > 0) {
+        buildRange(keys, 0, count, 0, bounds);
+    }
+}
+
+void LinearTree::buildRange(std::vector<uint64_t> &keys, int lo, int hi, int level, Quadrant quadrant) {
+    int current = nodes.size();
+    std::vector<double> &x = leaves.x;
+    std::vector<double> &y = leaves.y;
+    std::vector<double> &m = leaves.m;
+    LinearNode temp;
+    temp.cx = quadrant.getXHalfway();
+    temp.cy = quadrant.getYHalfway();
+    temp.halfWidth = (quadrant.getXMax() - quadrant.getXMin()) / 2;
+    temp.qxx = temp.qxy = temp.qyy = 0;
+    temp.reach = 0;
+    temp.first = lo;
+    temp.count = hi - lo;
+    nodes.push_back(temp);
+
+    double mass = 0, xMass = 0, yMass = 0;
+    // child nodes, for the quadrupole pass once the centre of mass is known
+    int childNodes[4];
+    int childCount = 0;
+    if (hi - lo == 1) {
+        nodes[current].x = x[lo];
+        nodes[current].y = y[lo];
+        nodes[current].m = m[lo];
+        nodes[current].next = nodes.size();
+        return;
+    } else if (level == MORTON_BITS || hi - lo <= leafCapacity) {
+        // bodies that share a full key stay together in one leaf, and so
+        // do up to leafCapacity bodies
+        for (int b = lo; b < hi; b++) {
+            mass += m[b];
+            xMass += x[b] * m[b];
+            yMass += y[b] * m[b];
+        }
+    } else {
+        Quadrant children[4] = { quadrant.botLeft(), quadrant.botRight(),
+                quadrant.topLeft(), quadrant.topRight() };
+        int start = lo;
+        for (int d = 0; d < 4 && start < hi; d++) {
+            int end = hi;
+            if (d < 3) {
+                end = std::partition_point(keys.begin() + start, keys.begin() + hi,
+                        [level, d](uint64_t key) { return mortonDigit(key, level) <= d; })
+                        - keys.begin();
+            }
+            if (end > start) {
+                int child = nodes.size();
+                buildRange(keys, start, end, level + 1, children[d]);
+                childNodes[childCount++] = child;
+                mass += nodes[child].m;
+                xMass += nodes[child].x * nodes[child].m;
+                yMass += nodes[child].y * nodes[child].m;
+            }
+            start = end;
+        }
+    }
+    LinearNode &node = nodes[current];
+    node.x = xMass / mass;
+    node.y = yMass / mass;
+    node.m = mass;
+    node.next = nodes.size();
+
+    // quadrupole moments and reach, each body or child shifted to this
+    // centre of mass
+    for (int b = lo; b < hi && childCount == 0; b++) {
+        double sx = x[b] - node.x;
+        double sy = y[b] - node.y;
+        node.qxx += m[b] * (2 * sx * sx - sy * sy);
+        node.qxy += m[b] * 3 * sx * sy;
+        node.qyy += m[b] * (2 * sy * sy - sx * sx);
+        node.reach = std::max(node.reach, sqrt(sx * sx + sy * sy));
+    }
+    for (int c = 0; c < childCount; c++) {
+        const LinearNode &child = nodes[childNodes[c]];
+        double sx = child.x - node.x;
+        double sy = child.y - node.y;
+        node.qxx += child.qxx + child.m * (2 * sx * sx - sy * sy);
+        node.qxy += child.qxy + child.m * 3 * sx * sy;
+        node.qyy += child.qyy + child.m * (2 * sy * sy - sx * sx);
+        node.reach = std::max(node.reach, sqrt(sx * sx + sy * sy) + child.reach);
+    }
+}
+
+// potential energy of theBody against leaf bodies [first, last), without its own term
+static double leafPotential(const BodyArrays &leaves, Body *theBody, int first, int last) {
+    double res = 0;
+    for (int b = first; b < last; b++) {
+        // unlike the force, a body's own term is not 0
+        if (leaves.index[b] != theBody->index) {
+            double xDiff = leaves.x[b] - theBody->x;
+            double yDiff = leaves.y[b] - theBody->y;
+            res += calcPotential(theBody->m, leaves.m[b], sqrt((xDiff * xDiff) + (yDiff * yDiff)));
+        }
+    }
+    return res;
+}
+
+// Leaves the number of interactions in theBody->cost.
+std::pair<double, double> LinearTree::calcForceOn(Body *theBody, double theta, bool quadrupole,
+        WalkCounts *counts, double *potential) {
+    std::vector<double> &x = leaves.x;
+    std::vector<double> &y = leaves.y;
+    std::vector<double> &m = leaves.m;
+    double resX = 0, resY = 0;
+    int interactions = 0;
+    int visited = 0, leafInteractions = 0;
+    int end = nodes.size();
+    int i = 0;
+    while (i < end) {
+        visited++;
+        const LinearNode &node = nodes[i];
+        bool leaf = node.next == i + 1;
+        if (!leaf || node.count > 1) {
+            // cells, and leaves holding several bodies, may be taken whole
+            double xDiff = node.x - theBody->x;
+            double yDiff = node.y - theBody->y;
+            double d = sqrt((xDiff * xDiff) + (yDiff * yDiff));
+            if (checkMAC(2 * node.halfWidth, d, theta)
+                    && (!quadrupole || clearOfSoftening(node.reach, d, d))) {
+                resX += calcDimF(theBody->m, node.m, d, xDiff);
+                resY += calcDimF(theBody->m, node.m, d, yDiff);
+                if (potential != nullptr) {
+                    *potential += calcPotential(theBody->m, node.m, d);
+                }
+                if (quadrupole) {
+                    double ax = 0, ay = 0;
+                    addQuadrupole(xDiff, yDiff, node.qxx, node.qxy, node.qyy, ax, ay);
+                    resX += theBody->m * ax;
+                    resY += theBody->m * ay;
+                }
+                interactions++;
+                i = node.next;
+                continue;
+            }
+        }
+        if (!leaf) {
+            i++;
+        } else if (node.count > 1) {
+            // a body meets itself at distance 0, which adds exactly 0
+            double ax = 0, ay = 0;
+            accumulateAccel(theBody->x, theBody->y, &x[node.first], &y[node.first], &m[node.first],
+                    node.count, ax, ay);
+            resX += theBody->m * ax;
+            resY += theBody->m * ay;
+            if (potential != nullptr) {
+                *potential += leafPotential(leaves, theBody, node.first, node.first + node.count);
+            }
+            interactions += node.count;
+            leafInteractions += node.count;
+            i = node.next;
+        } else {
+            int b = node.first;
+            if (leaves.index[b] != theBody->index) {
+                double xDiff = x[b] - theBody->x;
+                double yDiff = y[b] - theBody->y;
+                double d = sqrt((xDiff * xDiff) + (yDiff * yDiff));
+                resX += calcDimF(theBody->m, m[b], d, xDiff);
+                resY += calcDimF(theBody->m, m[b], d, yDiff);
+                if (potential != nullptr) {
+                    *potential += calcPotential(theBody->m, m[b], d);
+                }
+                interactions++;
+                leafInteractions++;
+            }
+            i = node.next;
+        }
+    }
+    theBody->cost = interactions;
+    if (counts != nullptr) {
+        counts->visited += visited;
+        counts->accepted += interactions - leafInteractions;
+        counts->leaf += leafInteractions;
+    }
+    return {resX, resY};
+}
+
+/**
+ * Splits the tree into the largest subtrees holding at most groupSize
+ * bodies. Groups come out in depth-first order and between them cover
+ * every body exactly once.
+ */
+void LinearTree::findGroups(int groupSize, std::vector<int> &groups) {
+    groups.clear();
+    int end = nodes.size();
+    int i = 0;
+    while (i < end) {
+        if (nodes[i].count <= groupSize || nodes[i].next == i + 1) {
+            groups.push_back(i);
+            i = nodes[i].next;
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * Group walk: one traversal for all bodies under node `group`. A cell is
+ * accepted only if the MAC holds at its closest approach to the group's
+ * bounding box, which implies it holds for every body in the group.
+ * Everything accepted or opened goes into a single interaction list that
+ * each body in the group is then summed against. With `remote`, that
+ * tree is walked for the same group and added to the list as well.
+ *
+ * forces is indexed by position in the leaf arrays; only the group's
+ * range [first, first + count) is written. counts take every accepted
+ * cell and list body once per body of the group. potentials, indexed the
+ * same way, get each body's potential energy against the list.
+ */
+void LinearTree::calcForcesOnGroup(int group, double theta, bool quadrupole, InteractionList &list,
+        std::vector<std::pair<double, double>> &forces, LinearTree *remote, WalkCounts *counts,
+        std::vector<double> *potentials) {
+    const LinearNode &target = nodes[group];
+    std::vector<double> &x = leaves.x;
+    std::vector<double> &y = leaves.y;
+    std::vector<double> &m = leaves.m;
+    int first = target.first;
+    int last = target.first + target.count;
+
+    double xMin = x[first], xMax = x[first];
+    double yMin = y[first], yMax = y[first];
+    for (int b = first + 1; b < last; b++) {
+        xMin = std::min(xMin, x[b]);
+        xMax = std::max(xMax, x[b]);
+        yMin = std::min(yMin, y[b]);
+        yMax = std::max(yMax, y[b]);
+    }
+
+    list.clear();
+    WalkCounts walk = {};
+    addInteractions(xMin, xMax, yMin, yMax, theta, quadrupole, group, list, &walk);
+    if (remote != nullptr) {
+        remote->addInteractions(xMin, xMax, yMin, yMax, theta, quadrupole, -1, list, &walk);
+    }
+    if (counts != nullptr) {
+        counts->visited += walk.visited;
+        counts->accepted += walk.accepted * target.count;
+        counts->leaf += (list.x.size() - walk.accepted) * target.count;
+    }
+
+    // A body meets itself in the list at distance 0, which adds exactly 0.
+    int listSize = list.x.size();
+    int quadSize = list.qx.size();
+    for (int b = first; b < last; b++) {
+        double ax = 0, ay = 0;
+        accumulateAccel(x[b], y[b], list.x.data(), list.y.data(), list.m.data(), listSize, ax, ay);
+        accumulateQuadrupole(x[b], y[b], list.qx.data(), list.qy.data(),
+                list.qxx.data(), list.qxy.data(), list.qyy.data(), quadSize, ax, ay);
+        forces[b].first = m[b] * ax;
+        forces[b].second = m[b] * ay;
+        if (potentials == nullptr) {
+            continue;
+        }
+        // skipping the body's own entry, which unlike its force is not 0
+        double potential = 0;
+        int self = list.own + b - first;
+        for (int k = 0; k < listSize; k++) {
+            if (k != self) {
+                double xDiff = list.x[k] - x[b];
+                double yDiff = list.y[k] - y[b];
+                potential += calcPotential(m[b], list.m[k], sqrt((xDiff * xDiff) + (yDiff * yDiff)));
+            }
+        }
+        (*potentials)[b] = potential;
+    }
+}
+
+/**
+ * Appends what a box of targets sees of this tree: cells that pass the
+ * MAC at their closest point to the box, and the bodies of leaves that
+ * do not. Node `group` (-1 for none) is taken body by body without
+ * looking inside it. With `quadrupole`, accepted cells also add their
+ * moments to the list.
+ */
+void LinearTree::addInteractions(double xMin, double xMax, double yMin, double yMax,
+        double theta, bool quadrupole, int group, InteractionList &list, WalkCounts *counts) {
+    std::vector<double> &x = leaves.x;
+    std::vector<double> &y = leaves.y;
+    std::vector<double> &m = leaves.m;
+    int end = nodes.size();
+    int i = 0;
+    int visited = 0, accepted = 0;
+    while (i < end) {
+        visited++;
+        const LinearNode &node = nodes[i];
+        bool leaf = node.next == i + 1;
+        if (i == group || (leaf && node.count == 1)) {
+            // the group's own bodies and single body leaves are taken one by one
+            if (i == group) {
+                list.own = list.x.size();
+            }
+            for (int b = node.first; b < node.first + node.count; b++) {
+                list.add(x[b], y[b], m[b]);
+            }
+            i = node.next;
+            continue;
+        }
+        double xDiff = std::max(std::max(xMin - node.x, node.x - xMax), 0.0);
+        double yDiff = std::max(std::max(yMin - node.y, node.y - yMax), 0.0);
+        double d = sqrt((xDiff * xDiff) + (yDiff * yDiff));
+        double xFar = std::max(node.x - xMin, xMax - node.x);
+        double yFar = std::max(node.y - yMin, yMax - node.y);
+        if (checkMAC(2 * node.halfWidth, d, theta)
+                && (!quadrupole || clearOfSoftening(node.reach, d, sqrt((xFar * xFar) + (yFar * yFar))))) {
+            list.add(node.x, node.y, node.m);
+            if (quadrupole) {
+                list.addQuadrupole(node);
+            }
+            accepted++;
+            i = node.next;
+        } else if (leaf) {
+            for (int b = node.first; b < node.first + node.count; b++) {
+                list.add(x[b], y[b], m[b]);
+            }
+            i = node.next;
+        } else {
+            i++;
+        }
+    }
+    if (counts != nullptr) {
+        counts->visited += visited;
+        counts->accepted += accepted;
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef LINEARTREE_H
+#define LINEARTREE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "body.h"
+#include "quadtree.h"
+#include "helpers.h"
+#include "morton.h"
+
+/**
+ * One cell of a LinearTree. Children of node i start at i + 1 and the
+ * subtree ends right before `next`, so a node with next == i + 1 is a leaf.
+ */
+typedef struct LinearNode {
+    double x;           // centre of mass
+    double y;
+    double m;           // total mass
+    double cx;          // centre of the cell
+    double cy;
+    double halfWidth;   // half the side length of the cell
+    double qxx;         // quadrupole moments about (x, y), see addQuadrupole
+    double qxy;
+    double qyy;
+    double reach;       // no body is further than this from (x, y)
+    int next;           // first node after this subtree (skip to sibling)
+    int first;          // first of this subtree's bodies in the leaf arrays
+    int count;          // number of bodies in this subtree
+} LinearNode;
+
+/**
+ * Point masses a group of bodies interacts with: accepted cells and the
+ * bodies of leaves that had to be opened. Kept by the caller so the
+ * storage is reused from group to group.
+ */
+typedef struct InteractionList {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> m;
+    // quadrupole corrections of the accepted cells, when enabled
+    std::vector<double> qx;
+    std::vector<double> qy;
+    std::vector<double> qxx;
+    std::vector<double> qxy;
+    std::vector<double> qyy;
+    // where the group's own bodies start in x/y/m, -1 before they are added
+    int own = -1;
+
+    void clear();
+    void add(double px, double py, double pm);
+    void addQuadrupole(const LinearNode &node);
+} InteractionList;
+
+/**
+ * Pointerless quadtree laid out in depth-first order. It is either
+ * flattened from a QuadTree or built directly from Morton-sorted bodies.
+ *
+ * Leaf bodies are stored alongside in the same order, one array per field,
+ * so every subtree owns a contiguous range [first, first + count) of them.
+ * The force walk only ever moves forward through `nodes`, either to i + 1
+ * (open the cell) or to next (accept it).
+ */
+class LinearTree {
+public:
+    std::vector<LinearNode> nodes;
+
+    // leaf bodies in depth-first order
+    BodyArrays leaves;
+    // where each leaf body sits in the vector the tree was built from
+    std::vector<int> source;
+
+    void build(QuadTree *root, Body *base);
+    // leaves keep up to leafCapacity bodies before they are split
+    void buildSorted(std::vector<Body> &bodies, std::vector<uint64_t> &keys, int count, Quadrant &bounds,
+            int leafCapacity = 1);
+    void clear();
+    int size();
+
+    // with `potential`, theBody's potential energy against the accepted
+    // cells' monopoles and the opened leaves' bodies is added to it
+    std::pair<double, double> calcForceOn(Body *theBody, double theta, bool quadrupole,
+            WalkCounts *counts = nullptr, double *potential = nullptr);
+
+    void findGroups(int groupSize, std::vector<int> &groups);
+    void calcForcesOnGroup(int group, double theta, bool quadrupole, InteractionList &list,
+            std::vector<std::pair<double, double>> &forces, LinearTree *remote = nullptr,
+            WalkCounts *counts = nullptr, std::vector<double> *potentials = nullptr);
+    void addInteractions(double xMin, double xMax, double yMin, double yMax,
+            double theta, bool quadrupole, int group, InteractionList &list,
+            WalkCounts *counts = nullptr);
+
+private:
+    int leafCapacity = 1;
+
+    void flatten(QuadTree *node, Body *base);
+    void buildRange(std::vector<uint64_t> &keys, int lo, int hi, int level, Quadrant quadrant);
+};
+
+#endif
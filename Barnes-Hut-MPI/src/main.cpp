@@ -11,11 +11,30 @@
 #include "argparse.h"
 #include "helpers.h"
 #include "quadtree.h"
+#include "lineartree.h"
+#include "fmm.h"
+#include "spatialtree.h"
+#include "spatialio.h"
+#include "morton.h"
+#include "distributed.h"
+#include "threadpool.h"
+#include "parallelbuild.h"
+#include "bounds.h"
+#include "refit.h"
+#include "blocksteps.h"
+#include "integrator.h"
+#include "diagnostics.h"
+#include "profile.h"
+#include "parallelio.h"
+#include "checkpoint.h"
+#include "trajectory.h"
 #include "body.h"
 #include "io.h"
 #include "mpi.h"
 
 #include <unistd.h>
+#include <algorithm>
+#include <numeric>
 
 
 double convert(double coordinate) {
@@ -45,6 +64,21 @@ void drawOctreeBounds2D(QuadTree *node) {
     drawOctreeBounds2D(node->getBotRight());
 }
 
+void drawLinearBounds2D(LinearTree &tree) {
+    glBegin(GL_LINES);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < tree.size(); i++) {
+        LinearNode &node = tree.nodes[i];
+        if (node.next == i + 1) {
+            continue;
+        }
+        glVertex2f(convert(node.cx), convert(node.cy - node.halfWidth));
+        glVertex2f(convert(node.cx), convert(node.cy + node.halfWidth));
+        glVertex2f(convert(node.cx - node.halfWidth), convert(node.cy));
+        glVertex2f(convert(node.cx + node.halfWidth), convert(node.cy));
+    }
+    glEnd();
+}
 
 void
 drawParticle2D(double x_window, double y_window,
@@ -61,25 +95,320 @@ drawParticle2D(double x_window, double y_window,
     glEnd();
 }
 
-void run(QuadTree *tree, std::vector<Body> &bodies, double theta, double dt){
-    std::vector<std::pair<double, double>> forces(bodies.size());
-    for(unsigned int i = 0; i < bodies.size(); i++) {
-        if (bodies[i].m > 0) {
-            double xForce;
-            double yForce;
-            std::tie(xForce, yForce) = tree->calcForceOn(&bodies[i], theta);
-            forces[i].first = (xForce);
-            forces[i].second = (yForce);
+// linear is null unless the flattened tree was requested with -l, remote
+// holds what other ranks sent over in distributed mode; counts may be null,
+// and so may potential, which the body's potential energy is added to
+std::pair<double, double> calcForce(QuadTree *tree, LinearTree *linear, LinearTree *remote,
+        Body *body, double theta, bool quadrupole, WalkCounts *counts, double *potential) {
+    if (linear == nullptr) {
+        return tree->calcForceOn(body, theta, quadrupole, counts, potential);
+    }
+    std::pair<double, double> force = linear->calcForceOn(body, theta, quadrupole, counts, potential);
+    if (remote != nullptr) {
+        int localCost = body->cost;
+        double xForce, yForce;
+        std::tie(xForce, yForce) = remote->calcForceOn(body, theta, quadrupole, counts, potential);
+        force.first += xForce;
+        force.second += yForce;
+        body->cost += localCost;
+    }
+    return force;
+}
+
+/**
+ * Picks this rank's share of the work items (bodies or groups). Either
+ * every size-th item, or one contiguous block holding about 1/size of the
+ * total weight.
+ */
+void assignWork(std::vector<double> &weights, bool contiguous, int rank, int size,
+        std::vector<int> &items) {
+    items.clear();
+    int count = weights.size();
+    if (!contiguous) {
+        for (int curr = rank; curr < count; curr += size) {
+            items.push_back(curr);
+        }
+        return;
+    }
+    double total = 0;
+    for (int j = 0; j < count; j++) {
+        total += weights[j];
+    }
+    double before = 0;
+    for (int j = 0; j < count; j++) {
+        int owner = total > 0 ? std::min(size - 1, (int)(before * size / total)) : 0;
+        before += weights[j];
+        if (owner == rank) {
+            items.push_back(j);
+        } else if (owner > rank) {
+            break;
         }
     }
+}
 
-    for (unsigned int i = 0; i < bodies.size(); i++) {
-        if (bodies[i].m > 0) {
-            calcNewPos(&bodies[i], dt, forces[i].first, forces[i].second);
+/**
+ * Computes forces on the bodies this rank is responsible for and moves
+ * them, leaving their slots in `indices`. Work is split per body, or with
+ * a group size the linear tree is cut into groups that are split between
+ * ranks and walked one group at a time. With `balance` the split weighs
+ * each body by the interactions it needed last step (cost zones).
+ *
+ * The rank's share is spread over `pool`. The trees are only read, and
+ * every body's force lands in its own slot, so results do not depend on
+ * the number of threads. With `quadrupole`, accepted cells add their
+ * quadrupole term to the monopole.
+ *
+ * With `fmm` the forces come from one FMM pass over the linear tree
+ * instead of a walk per body or group. Each rank takes a contiguous share
+ * of the bodies and the pass only evaluates those, spread over `pool`.
+ *
+ * Bodies are moved by `integrator` with the force of evaluation `stage`
+ * of the step. With `blocks` only the bodies starting a new block step get
+ * a force, and it is handed to `blocks` instead of moving them.
+ *
+ * With `diagnostics` each body's potential energy is summed in the same
+ * walk as its force, and the rank's share is added up before the bodies
+ * move.
+ *
+ * Force and integration times, and the walks' counts, go to `profile`.
+ */
+void run(QuadTree *tree, LinearTree *linear, LinearTree *remote, FMM *fmm, BlockSteps *blocks, int groupSize,
+        std::vector<Body> &bodies, bool contiguous, bool balance, int rank, int size,
+        ThreadPool &pool, double theta, bool quadrupole, double dt, Integrator &integrator, int stage,
+        std::vector<unsigned int> &indices, Diagnostics *diagnostics, Profile &profile){
+    double forceTime = MPI_Wtime();
+    // one set of counts per thread, none without --profile
+    std::vector<WalkCounts> walks(pool.size(), WalkCounts());
+    auto countsFor = [&](int thread) { return profile.enabled() ? &walks[thread] : nullptr; };
+    std::vector<std::pair<double, double>> forces;
+    // potential energy per entry of indices, on diagnostic steps
+    std::vector<double> potentials;
+    std::vector<double> weights;
+    std::vector<int> items;
+    indices.clear();
+    if (groupSize > 0 && fmm == nullptr) {
+        std::vector<int> found, groups;
+        std::vector<std::pair<double, double>> leafForces(linear->leaves.size());
+        std::vector<double> leafPotentials(diagnostics != nullptr ? linear->leaves.size() : 0);
+        std::vector<InteractionList> lists(pool.size());
+        linear->findGroups(groupSize, found);
+        for (unsigned int g = 0; g < found.size(); g++) {
+            LinearNode &node = linear->nodes[found[g]];
+            double weight = 0;
+            for (int b = node.first; b < node.first + node.count; b++) {
+                Body &body = bodies[linear->source[b]];
+                if (blocks == nullptr || blocks->isActive(body)) {
+                    weight += balance ? std::max(body.cost, 1) : 1;
+                }
+            }
+            if (weight == 0) {
+                // no body in the group needs a force this tick
+                continue;
+            }
+            groups.push_back(found[g]);
+            weights.push_back(weight);
+        }
+        assignWork(weights, contiguous, rank, size, items);
+
+        // each group's bodies get a fixed stretch of indices/forces up front
+        std::vector<int> offsets(items.size());
+        for (unsigned int j = 0; j < items.size(); j++) {
+            LinearNode &node = linear->nodes[groups[items[j]]];
+            offsets[j] = indices.size();
+            for (int b = node.first; b < node.first + node.count; b++) {
+                indices.push_back(linear->source[b]);
+            }
+        }
+        forces.resize(indices.size());
+        potentials.resize(diagnostics != nullptr ? indices.size() : 0);
+        pool.parallelFor(items.size(), 1, [&](int j, int thread) {
+            int group = groups[items[j]];
+            LinearNode &node = linear->nodes[group];
+            InteractionList &list = lists[thread];
+            linear->calcForcesOnGroup(group, theta, quadrupole, list, leafForces, remote, countsFor(thread),
+                    diagnostics != nullptr ? &leafPotentials : nullptr);
+            for (int b = node.first; b < node.first + node.count; b++) {
+                forces[offsets[j] + b - node.first] = leafForces[b];
+                // every body in the group goes through the whole list
+                bodies[linear->source[b]].cost = list.x.size();
+                if (diagnostics != nullptr) {
+                    potentials[offsets[j] + b - node.first] = leafPotentials[b];
+                }
+            }
+        });
+        if (rank == 0) {
+            // bodies left out of the tree still have to be accounted for
+            for (unsigned int i = 0; i < bodies.size(); i++) {
+                if (bodies[i].m <= 0) {
+                    indices.push_back(i);
+                    forces.push_back({0.0, 0.0});
+                    if (diagnostics != nullptr) {
+                        potentials.push_back(0.0);
+                    }
+                }
+            }
+        }
+    } else {
+        std::vector<unsigned int> candidates;
+        for (unsigned int i = 0; i < bodies.size(); i++) {
+            if (blocks == nullptr || blocks->isActive(bodies[i])) {
+                candidates.push_back(i);
+                weights.push_back(balance ? std::max(bodies[i].cost, 1) : 1);
+            }
+        }
+        // contiguous shares of the Morton order keep each rank's FMM targets in few cells
+        assignWork(weights, contiguous || fmm != nullptr, rank, size, items);
+        for (unsigned int j = 0; j < items.size(); j++) {
+            indices.push_back(candidates[items[j]]);
+        }
+        std::vector<std::pair<double, double>> fieldForces;
+        std::vector<double> fieldPotentials;
+        if (fmm != nullptr) {
+            std::vector<char> owned(bodies.size(), 0);
+            for (unsigned int j = 0; j < indices.size(); j++) {
+                owned[indices[j]] = 1;
+            }
+            std::vector<char> wanted(linear->leaves.size());
+            for (unsigned int b = 0; b < wanted.size(); b++) {
+                wanted[b] = owned[linear->source[b]];
+            }
+            std::vector<std::pair<double, double>> leafForces;
+            std::vector<double> leafPotentials;
+            fmm->calcForces(*linear, theta, pool, &wanted, leafForces,
+                    diagnostics != nullptr ? &leafPotentials : nullptr);
+            walks[0].visited += fmm->pairsVisited;
+            walks[0].accepted += fmm->cellInteractions;
+            walks[0].leaf += fmm->pairInteractions;
+            fieldForces.assign(bodies.size(), {0.0, 0.0});
+            fieldPotentials.assign(diagnostics != nullptr ? bodies.size() : 0, 0.0);
+            for (unsigned int b = 0; b < leafForces.size(); b++) {
+                fieldForces[linear->source[b]] = leafForces[b];
+                if (diagnostics != nullptr) {
+                    fieldPotentials[linear->source[b]] = leafPotentials[b];
+                }
+            }
+        }
+        forces.resize(indices.size());
+        potentials.resize(diagnostics != nullptr ? indices.size() : 0);
+        pool.parallelFor(indices.size(), 64, [&](int j, int thread) {
+            if (fmm != nullptr) {
+                forces[j] = fieldForces[indices[j]];
+                if (diagnostics != nullptr) {
+                    potentials[j] = fieldPotentials[indices[j]];
+                }
+            } else if (bodies[indices[j]].m > 0) {
+                double xForce;
+                double yForce;
+                std::tie(xForce, yForce) = calcForce(tree, linear, remote, &bodies[indices[j]], theta, quadrupole,
+                        countsFor(thread), diagnostics != nullptr ? &potentials[j] : nullptr);
+                forces[j].first = (xForce);
+                forces[j].second = (yForce);
+            }
+        });
+    }
+
+    if (diagnostics != nullptr) {
+        // in index order, so the sums do not depend on the threads
+        for (unsigned int j = 0; j < indices.size(); j++) {
+            Body &body = bodies[indices[j]];
+            if (body.m > 0) {
+                double vx, vy;
+                integrator.velocityAt(body, stage, dt, forces[j].first, forces[j].second, vx, vy);
+                diagnostics->add(body, vx, vy, potentials[j]);
+            }
         }
     }
+
+    for (int t = 0; t < pool.size(); t++) {
+        profile.add(walks[t]);
+    }
+    profile.add(PHASE_FORCE, MPI_Wtime() - forceTime);
+
+    double integrateTime = MPI_Wtime();
+    pool.parallelFor(indices.size(), 256, [&](int j, int thread) {
+        if (bodies[indices[j]].m <= 0) {
+            return;
+        }
+        if (blocks != nullptr) {
+            if (blocks->isActive(bodies[indices[j]])) {
+                blocks->setForce(bodies[indices[j]], forces[j].first, forces[j].second);
+            }
+        } else {
+            integrator.update(bodies[indices[j]], stage, dt, forces[j].first, forces[j].second);
+        }
+    });
+    profile.add(PHASE_INTEGRATE, MPI_Wtime() - integrateTime);
 }
 
+/**
+ * The --dimensions run. Every rank keeps all bodies and builds the same
+ * SpatialTree<D>, moves a contiguous 1/size of them over the pool and
+ * shares them with MPI_Allgatherv. Rank 0 reads and writes the files and,
+ * given a window, draws the x/y projection.
+ */
+template <int D>
+void simulateSpatial(options_t &opts, double theta, double dt, int steps, bool binary,
+        ThreadPool &pool, GLFWwindow *window, int rank, int size, double start) {
+    std::vector<SpatialBody<D>> bodies;
+    if (rank == 0 && !readSpatialFile<D>(opts.inputFileName, bodies)) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int count = bodies.size();
+    MPI_Bcast(&count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    bodies.resize(count);
+
+    int blockLen[3] = {1, 1, 2 * D + 1};
+    MPI_Datatype types[3] = { MPI_INT, MPI_INT, MPI_DOUBLE };
+    MPI_Aint offsets[3] = {
+            offsetof(SpatialBody<D>, index),
+            offsetof(SpatialBody<D>, cost),
+            offsetof(SpatialBody<D>, pos) };
+    MPI_Datatype mpiBody;
+    MPI_Type_create_struct(3, blockLen, offsets, types, &mpiBody);
+    MPI_Type_commit(&mpiBody);
+    MPI_Bcast(bodies.data(), count, mpiBody, 0, MPI_COMM_WORLD);
+
+    std::vector<int> counts(size), displs(size);
+    for (int r = 0; r < size; r++) {
+        displs[r] = (long)count * r / size;
+        counts[r] = (long)count * (r + 1) / size - displs[r];
+    }
+    int first = displs[rank];
+    std::vector<double> forces(D * counts[rank]);
+    SpatialTree<D> tree;
+    for (int i = 0; i < steps; i++) {
+        double min[D];
+        double width = SpatialTree<D>::findCube(bodies, min);
+        tree.build(bodies, min, width);
+        pool.parallelFor(counts[rank], 64, [&](int j, int thread) {
+            if (bodies[first + j].m > 0) {
+                tree.calcForceOn(bodies[first + j], theta, &forces[D * j]);
+            }
+        });
+        pool.parallelFor(counts[rank], 256, [&](int j, int thread) {
+            if (bodies[first + j].m > 0) {
+                advance(bodies[first + j], dt, &forces[D * j]);
+            }
+        });
+        if (size > 1) {
+            MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.data(),
+                    counts.data(), displs.data(), mpiBody, MPI_COMM_WORLD);
+        }
+
+        if (window != nullptr) {
+            glClear( GL_COLOR_BUFFER_BIT );
+            for (unsigned int p = 0; p < bodies.size(); p++)
+                drawParticle2D(bodies[p].pos[0], bodies[p].pos[1], 0.01);
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+    }
+    MPI_Type_free(&mpiBody);
+    if (rank == 0) {
+        std::cout << MPI_Wtime() - start << std::endl;
+        writeSpatialFile<D>(opts.outputFileName, bodies, binary, steps, dt, theta);
+    }
+}
 
 int main(int argc, char* argv[]){
     MPI_Init(&argc, &argv);
@@ -96,13 +425,82 @@ int main(int argc, char* argv[]){
     double theta;
     double dt; 
     int steps;
+    bool linear;
+    bool morton;
+    bool distributed;
+    bool allgather;
+    bool balance;
+    bool visualize;
+    int groupSize;
+    int threads;
+    bool binary;
+    bool quadrupole;
+    // expansion order, 0 without -e
+    int fmmOrder;
+    int leafCapacity;
+    // steps between full rebuilds, 0 without --refit
+    int refitEvery;
+    // deepest block step level, 0 without --block-levels
+    int blockLevels;
+    int scheme;
+    // distributed runs on a binary input read their slices with MPI-IO
+    bool parallelRead;
+    std::string inputName, outputName;
+    // empty without --profile
+    std::string profileName;
+    int checkpointEvery;
+    // 0 without --trajectory
+    int trajectoryEvery;
+    // 0 without --diagnostics
+    int diagnosticsEvery;
+    // 0 for the 2D trees, 3 with --dimensions 3
+    int dimensions;
+    // steps already taken by the run being restarted
+    int startStep = 0;
     int totalNumBodies;
     if(rank == 0) {
         get_opts(argc, argv, &opts);
+        if (opts.restartFileName != nullptr) {
+            BodyFileHeader header;
+            if (!readHeader(opts.restartFileName, header)) {
+                std::cerr << "ERROR: " << opts.restartFileName << " is not a checkpoint" << std::endl;
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            startStep = header.step;
+            if (header.version >= 2 && header.dt != 0) {
+                opts.timeStep = header.dt;
+                opts.theta = header.theta;
+            }
+        }
         theta = opts.theta;
         dt = opts.timeStep;
         steps = opts.steps;
-        readFile(opts.inputFileName, &opts, bodies);
+        linear = opts.linear;
+        morton = opts.morton;
+        distributed = opts.distributed;
+        allgather = opts.allgather;
+        balance = opts.balance;
+        visualize = opts.visualize;
+        groupSize = opts.groupSize;
+        threads = opts.threads;
+        binary = opts.binary;
+        quadrupole = opts.quadrupole;
+        fmmOrder = opts.fmmOrder;
+        leafCapacity = opts.leafCapacity;
+        refitEvery = opts.refitEvery;
+        blockLevels = opts.blockLevels;
+        scheme = opts.integrator;
+        checkpointEvery = opts.checkpointEvery;
+        trajectoryEvery = opts.trajectoryFileName != nullptr ? std::max(opts.trajectoryEvery, 1) : 0;
+        diagnosticsEvery = opts.diagnosticsFileName != nullptr ? std::max(opts.diagnosticsEvery, 1) : 0;
+        parallelRead = distributed && isBinaryFile(opts.inputFileName);
+        dimensions = opts.dimensions;
+        inputName = opts.inputFileName;
+        outputName = opts.outputFileName;
+        profileName = opts.profileName != nullptr ? opts.profileName : "";
+        if (!parallelRead && dimensions == 0 && !readFile(opts.inputFileName, &opts, bodies)) {
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
         totalNumBodies = bodies.size();
     }
 
@@ -133,21 +531,51 @@ int main(int argc, char* argv[]){
     MPI_Bcast(&theta, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Bcast(&dt, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Bcast(&steps, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&linear, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&morton, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&distributed, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&allgather, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&balance, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&visualize, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&groupSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&threads, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&binary, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&quadrupole, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&fmmOrder, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&leafCapacity, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&refitEvery, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&blockLevels, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&scheme, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&parallelRead, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&checkpointEvery, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&trajectoryEvery, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&diagnosticsEvery, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&startStep, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&totalNumBodies, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&dimensions, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    if (rank != 0) {
+    if (dimensions > 0) {
+        ThreadPool pool(threads);
+        GLFWwindow *view = rank == 0 && visualize ? window : nullptr;
+        simulateSpatial<3>(opts, theta, dt, steps, binary, pool, view, rank, size, start);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (rank != 0 && !distributed) {
         bodies.resize(totalNumBodies);
     }
 
     // define bodies struct
-    const int numItems = 6;
-    int blockLen[6] = {1, 1, 1, 1, 1, 1};
-    MPI_Datatype types[6] = { MPI_INT, MPI_DOUBLE, 
+    const int numItems = 7;
+    int blockLen[7] = {1, 1, 1, 1, 1, 1, 1};
+    MPI_Datatype types[7] = { MPI_INT, MPI_INT, MPI_DOUBLE,
             MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, 
             MPI_DOUBLE };
     MPI_Datatype mpiBody;
-    MPI_Aint offsets[6] = {
+    MPI_Aint offsets[7] = {
             offsetof(Body, index),
+            offsetof(Body, cost),
             offsetof(Body, x),
             offsetof(Body, y),
             offsetof(Body, m),
@@ -159,89 +587,364 @@ int main(int argc, char* argv[]){
 
     MPI_Type_create_struct(numItems, blockLen, offsets, types, &mpiBody);
     MPI_Type_commit(&mpiBody);
-    for (int i = 0; i < steps; i++) {
+
+    // one node pool for the whole run, emptied at the top of every step
+    // distributed mode: this rank's bodies, and point masses sent by others
+    std::vector<Body> local;
+    std::vector<Body> imported;
+    LinearTree remoteTree;
+    std::vector<uint64_t> remoteKeys;
+    if (distributed) {
+        bcastString(inputName, rank);
+        bcastString(outputName, rank);
+    }
+    // every rank takes part in the gathers, only rank 0 writes
+    bcastString(profileName, rank);
+    Profile profile(profileName.empty() ? nullptr : profileName.c_str(), rank, size);
+    if (parallelRead) {
+        if (!readBodiesParallel(inputName.c_str(), local, totalNumBodies, rank, size)) {
+            if (rank == 0) {
+                std::cerr << "ERROR: Unable to read " << inputName << std::endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    } else if (distributed) {
+        scatterBodies(bodies, local, mpiBody, rank, size);
+    } else if (allgather) {
+        // from here on every rank keeps its own full copy up to date
         MPI_Bcast(&bodies[0], bodies.size(), mpiBody, 0, MPI_COMM_WORLD);
-        double treeTime = MPI_Wtime();
+    }
+
+    ThreadPool pool(threads);
+    NodeArena arena(distributed ? 0 : 2 * totalNumBodies);
+    // subtrees built by each thread when the pointer tree is built in parallel
+    std::vector<std::unique_ptr<NodeArena>> threadArenas;
+    for (int t = 0; t < (threads > 1 && !distributed ? threads : 0); t++) {
+        threadArenas.push_back(std::unique_ptr<NodeArena>(new NodeArena(2 * totalNumBodies / threads)));
+        threadArenas.back()->leafCapacity = leafCapacity;
+    }
+    arena.leafCapacity = leafCapacity;
+    LinearTree linearTree;
+    LinearTree *flat = linear ? &linearTree : nullptr;
+    std::unique_ptr<FMM> fmm;
+    if (fmmOrder > 0) {
+        fmm.reset(new FMM(fmmOrder));
+    }
+    std::unique_ptr<BlockSteps> blocks;
+    if (blockLevels > 0) {
+        blocks.reset(new BlockSteps(totalNumBodies, blockLevels, dt));
+    }
+    Integrator integrator(scheme);
+    // force evaluations per step: block step ticks, or the integrator's stages
+    int passes = blocks ? blocks->substeps() : integrator.stages();
+    // recomputed around the bodies every step
+    Quadrant rootBounds;
+    std::vector<uint64_t> keys;
 
-        QuadTree *tree = new QuadTree(4.0, 4.0);
-        for (unsigned int j = 0; j < bodies.size(); j++) {
-            //std::cout << "inserting " << bodies[j]->getIndex() << " into tree" << std::endl;
-            tree->insert(&bodies[j]);
+    // where each body index currently sits in `bodies`, the Morton
+    // build reorders them every step
+    std::vector<int> slot(distributed ? 0 : totalNumBodies);
+    std::iota(slot.begin(), slot.end(), 0);
+    // with --refit, the tree carried over from the last step and when it was built
+    QuadTree *keptTree = nullptr;
+    int lastBuild = 0;
+    double builtDepth = 0;
+    RefitCounts refitCounts = {};
+    Checkpointer checkpointer(outputName + ".ckpt", rank);
+    // distributed runs write each rank's own bodies, replicated ones rank 0's
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    if (trajectoryEvery > 0 && (distributed || rank == 0)) {
+        std::string trajectoryName = rank == 0 ? opts.trajectoryFileName : "";
+        if (distributed) {
+            bcastString(trajectoryName, rank);
         }
+        trajectory.reset(new TrajectoryWriter(distributed ? MPI_COMM_WORLD : MPI_COMM_SELF,
+                totalNumBodies, dt, trajectoryEvery));
+        if (!trajectory->open(trajectoryName, startStep)) {
+            if (rank == 0) {
+                std::cerr << "ERROR: Unable to write " << trajectoryName
+                        << ", or it is another run's trajectory" << std::endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    std::unique_ptr<DiagnosticsLog> diagnosticsLog;
+    if (diagnosticsEvery > 0) {
+        diagnosticsLog.reset(new DiagnosticsLog(rank));
+        if (rank == 0 && !diagnosticsLog->open(opts.diagnosticsFileName)) {
+            std::cerr << "ERROR: Unable to write " << opts.diagnosticsFileName << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    Diagnostics diagnostics;
+    // when the last phase ended, each lap charges the time since to a phase
+    double mark = MPI_Wtime();
+    auto lap = [&](int phase) {
+        double now = MPI_Wtime();
+        profile.add(phase, now - mark);
+        mark = now;
+    };
+    // queues the positions after `step` steps, the writer's thread does the rest
+    auto recordFrame = [&](int step) {
+        if (trajectory) {
+            trajectory->add(step, distributed ? local : bodies);
+        }
+    };
+    for (int i = startStep; i < steps; i++) {
+        mark = MPI_Wtime();
+        if (trajectoryEvery > 0 && i % trajectoryEvery == 0) {
+            recordFrame(i);
+        } else if (trajectory) {
+            trajectory->poll();
+        }
+        if (checkpointEvery > 0) {
+            // the state at the top of step i is what i steps produced
+            checkpointer.poll();
+            if (i > startStep && i % checkpointEvery == 0) {
+                if (distributed) {
+                    checkpointer.writeParallel(local, totalNumBodies, i, dt, theta, size);
+                } else if (rank == 0) {
+                    checkpointer.write(bodies, i, dt, theta);
+                }
+            }
+        }
+        lap(PHASE_IO);
+        bool diagnose = diagnosticsEvery > 0 && i % diagnosticsEvery == 0;
+        diagnostics.clear();
+        if (distributed) {
+            pool.parallelFor(local.size(), 256, [&](int j, int thread) {
+                if (local[j].m > 0) {
+                    integrator.begin(local[j], dt);
+                }
+            });
+            lap(PHASE_INTEGRATE);
+            // this rank's interactions over all stages, for -b
+            double work = 0;
+            for (int stage = 0; stage < passes; stage++) {
+                // each rank only ever holds its own bodies and a pruned view of the rest
+                rootBounds = findBounds(local, pool, true);
+                lap(PHASE_TREE);
+                partitionBodies(local, rootBounds, balance, mpiBody, rank, size);
+                lap(PHASE_COMM);
+                int count = sortByMorton(local, rootBounds, keys);
+                linearTree.buildSorted(local, keys, count, rootBounds, leafCapacity);
+                lap(PHASE_TREE);
+                exchangeEssential(linearTree, theta, imported, rank, size);
+                lap(PHASE_COMM);
+                int remoteCount = sortByMorton(imported, rootBounds, remoteKeys);
+                remoteTree.buildSorted(imported, remoteKeys, remoteCount, rootBounds, leafCapacity);
+                lap(PHASE_TREE);
 
-        treeTime = MPI_Wtime() - treeTime;
-        // if(rank == 0)
-        // std::cout << "tree time: " << treeTime << ", ";
+                std::vector<unsigned int> indices;
+                run(nullptr, &linearTree, &remoteTree, nullptr, nullptr, groupSize, local, true, false, 0, 1, pool, theta, quadrupole, dt,
+                        integrator, stage, indices, diagnose && stage == 0 ? &diagnostics : nullptr, profile);
+                if (balance) {
+                    work += workOf(local, indices);
+                }
+                // run() charged its own force and integrate time
+                mark = MPI_Wtime();
+            }
+            if (balance) {
+                reportImbalance(work, i, rank);
+            }
+            if (diagnose) {
+                diagnosticsLog->record(diagnostics, i, i * dt);
+            }
+            lap(PHASE_IO);
+            profile.endStep(i);
 
-        if(size == 1) {
-            double runTime = MPI_Wtime();
-            run(tree, bodies, opts.theta, opts.timeStep);
-            runTime = MPI_Wtime() - runTime;
-            // std::cout << "run time: " << runTime << std::endl;
-        } else {
-            // calculate which ones this process works on.
-            std::vector<unsigned int> indices;
-            int nBodies = bodies.size(); 
-            for(int curr = rank; curr < nBodies; curr += size) {
-                indices.push_back(curr);
-            }
-            std::vector<std::pair<double, double>> forces(indices.size());
-            double runTime = MPI_Wtime();
-            for (unsigned int j = 0; j < indices.size(); j++){
-                if (bodies[indices[j]].m > 0) {
-                    double xForce;
-                    double yForce;
-                    std::tie(xForce, yForce) = tree->calcForceOn(&bodies[indices[j]], theta);
-                    forces[j].first = (xForce);
-                    forces[j].second = (yForce);
-                }
-            }
-            runTime = MPI_Wtime() - runTime;
-            // if(rank == 0)
-            // std::cout << "runtime: " << runTime << ", ";
-            for (unsigned int j = 0; j < indices.size(); j++) {
-                if (bodies[indices[j]].m > 0) {
-                    calcNewPos(&bodies[indices[j]], dt, forces[j].first, forces[j].second);
+            if (visualize) {
+                gatherBodies(local, bodies, mpiBody, rank, size);
+            }
+            if (rank == 0 && visualize) {
+                glClear( GL_COLOR_BUFFER_BIT );
+                drawLinearBounds2D(linearTree);
+                for(unsigned int p = 0; p < bodies.size(); p++)
+                    drawParticle2D(bodies[p].x, bodies[p].y, 0.01);
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+            }
+            continue;
+        }
+
+        if (!allgather) {
+            MPI_Bcast(&bodies[0], bodies.size(), mpiBody, 0, MPI_COMM_WORLD);
+        }
+        lap(PHASE_COMM);
+        if (!blocks) {
+            pool.parallelFor(bodies.size(), 256, [&](int j, int thread) {
+                if (bodies[j].m > 0) {
+                    integrator.begin(bodies[j], dt);
+                }
+            });
+        }
+        lap(PHASE_INTEGRATE);
+        QuadTree *tree = nullptr;
+        // this rank's interactions over all passes, for -b
+        double work = 0;
+        // one pass per block step tick or integrator stage
+        for (int pass = 0; pass < passes; pass++) {
+            int moved;
+            bool refitted = false;
+            if (refitEvery > 0 && keptTree != nullptr) {
+                // every rank refits the same tree from the same bodies
+                if (i - lastBuild >= refitEvery) {
+                    refitCounts.scheduled++;
+                } else if (!refitTree(keptTree, moved)) {
+                    refitCounts.escaped++;
+                } else if (meanDepth(keptTree) > REFIT_MAX_DEPTH_GROWTH * builtDepth) {
+                    refitCounts.deeper++;
+                } else {
+                    refitCounts.refits++;
+                    refitted = true;
                 }
             }
-            if ( rank != 0) {
-                //std::cout << "size is " << indices.size() << std::endl;
-                for (unsigned int j = 0; j < indices.size(); j++) {
-                    MPI_Send(&bodies[indices[j]], 1, mpiBody, 0, 0, MPI_COMM_WORLD);
+            if (refitted) {
+                tree = keptTree;
+                if (linear) {
+                    linearTree.build(tree, bodies.data());
                 }
             } else {
-                int numReceives = bodies.size() - indices.size();
-                // MPI_Status status;
-                //std::cout << "size: " << bodies.size() << " trying to receive " << numReceives << std::endl;
-                double recvTime = MPI_Wtime();
-                Body *temp = (Body *)malloc(sizeof(Body));
-                for(int j = 0; j < numReceives; j++) {
-                    MPI_Recv(temp, 1, mpiBody, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                    int index = temp->index;
-                    copy(*temp, bodies[index]); 
+                // every rank holds the same bodies here, so no reduction is needed
+                rootBounds = findBounds(bodies, pool, false);
+                if (refitEvery > 0) {
+                    rootBounds = refitBounds(rootBounds);
+                }
+
+                arena.reset();
+                for (unsigned int t = 0; t < threadArenas.size(); t++) {
+                    threadArenas[t]->reset();
+                }
+                if (morton) {
+                    int count = sortByMorton(bodies, rootBounds, keys);
+                    linearTree.buildSorted(bodies, keys, count, rootBounds, leafCapacity);
+                    for (unsigned int j = 0; j < bodies.size(); j++) {
+                        slot[bodies[j].index] = j;
+                    }
+                } else if (pool.size() > 1) {
+                    tree = buildTreeParallel(arena, threadArenas, bodies, rootBounds, pool);
+                    if (linear) {
+                        linearTree.build(tree, bodies.data());
+                    }
+                } else {
+                    tree = arena.newNode(rootBounds);
+                    for (unsigned int j = 0; j < bodies.size(); j++) {
+                        //std::cout << "inserting " << bodies[j]->getIndex() << " into tree" << std::endl;
+                        tree->insert(&bodies[j], false);
+                    }
+                    // mass is summed in the same order as the parallel build, so -j gives the same tree
+                    tree->computeMass();
+                    if (linear) {
+                        linearTree.build(tree, bodies.data());
+                    }
+                }
+                if (refitEvery > 0) {
+                    keptTree = tree;
+                    lastBuild = i;
+                    builtDepth = meanDepth(tree);
+                }
+            }
+
+            bool sample = diagnose && pass == 0;
+            lap(PHASE_TREE);
+
+            std::vector<unsigned int> indices;
+            run(tree, flat, nullptr, fmm.get(), blocks.get(), groupSize, bodies, allgather, balance, rank, size, pool, theta, quadrupole, dt,
+                    integrator, blocks ? 0 : pass, indices, sample ? &diagnostics : nullptr, profile);
+            if (balance) {
+                work += workOf(bodies, indices);
+            }
+            // run() charged its own force and integrate time
+            mark = MPI_Wtime();
+
+            if (blocks) {
+                // ranks share forces and move every body themselves
+                blocks->share(bodies, indices, size);
+                lap(PHASE_COMM);
+                blocks->advance(bodies, pool);
+                lap(PHASE_INTEGRATE);
+            } else if (size > 1 && allgather) {
+                allgatherBodies(bodies, indices, slot, mpiBody, size);
+            } else if (size > 1) {
+                if ( rank != 0) {
+                    //std::cout << "size is " << indices.size() << std::endl;
+                    for (unsigned int j = 0; j < indices.size(); j++) {
+                        MPI_Send(&bodies[indices[j]], 1, mpiBody, 0, 0, MPI_COMM_WORLD);
+                    }
+                } else {
+                    int numReceives = bodies.size() - indices.size();
+                    // MPI_Status status;
+                    //std::cout << "size: " << bodies.size() << " trying to receive " << numReceives << std::endl;
+                    Body *temp = (Body *)malloc(sizeof(Body));
+                    for(int j = 0; j < numReceives; j++) {
+                        MPI_Recv(temp, 1, mpiBody, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                        int index = temp->index;
+                        copy(*temp, bodies[slot[index]]);
+                    }
+                    free(temp);
+                }
+                if (pass + 1 < passes) {
+                    // the next stage of this step walks the updated bodies on every rank
+                    MPI_Bcast(&bodies[0], bodies.size(), mpiBody, 0, MPI_COMM_WORLD);
                 }
-                free(temp);
-                recvTime = MPI_Wtime() - recvTime;
-                // std::cout << "recvTime " << recvTime << std::endl;
             }
+            lap(PHASE_COMM);
+        }
+        if (balance) {
+            reportImbalance(work, i, rank);
         }
+        if (diagnose) {
+            diagnosticsLog->record(diagnostics, i, i * dt);
+        }
+        lap(PHASE_IO);
+        profile.endStep(i);
 
         if(rank == 0 && opts.visualize) {
             glClear( GL_COLOR_BUFFER_BIT );
-            drawOctreeBounds2D(tree);
+            if (tree != nullptr) {
+                drawOctreeBounds2D(tree);
+            } else {
+                drawLinearBounds2D(linearTree);
+            }
             for(unsigned int p = 0; p < bodies.size(); p++)
                 drawParticle2D(bodies[p].x, bodies[p].y, 0.01);
             // Swap buffers
             glfwSwapBuffers(window);
             glfwPollEvents();
         }
-        tree->~QuadTree();
+    }
+    mark = MPI_Wtime();
+    if (trajectoryEvery > 0 && steps % trajectoryEvery == 0) {
+        recordFrame(steps);
+    }
+    trajectory.reset();
+    checkpointer.finish();
+    // binary output from a distributed run goes straight from every rank
+    bool written = distributed && binary
+            && writeBodiesParallel(outputName.c_str(), local, totalNumBodies, steps, dt, theta, rank, size);
+    if (distributed && !written) {
+        gatherBodies(local, bodies, mpiBody, rank, size);
     }
     if(rank == 0) {
         double end = MPI_Wtime() - start;
         std::cout << end << std::endl;
-        write_file(&opts, bodies);
+        if (refitEvery > 0) {
+            std::cerr << "refit: " << refitCounts.refits << " refits, "
+                    << refitCounts.scheduled + refitCounts.escaped + refitCounts.deeper << " rebuilds ("
+                    << refitCounts.scheduled << " scheduled, "
+                    << refitCounts.escaped << " after a body left the root, "
+                    << refitCounts.deeper << " after the tree grew too deep)" << std::endl;
+        }
+        if (morton) {
+            std::sort(bodies.begin(), bodies.end(),
+                    [](const Body &a, const Body &b) { return a.index < b.index; });
+        }
+        if (!written) {
+            write_file(&opts, bodies);
+        }
     }
+    lap(PHASE_IO);
+    profile.finish();
     MPI_Finalize();
     return 0;
 }
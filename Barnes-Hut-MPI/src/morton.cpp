@@ -0,0 +1,106 @@
+#include "morton.h"
+
+// 0b abcd -> 0b 0a0b0c0d
+uint64_t spreadBits(uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2))  & 0x3333333333333333ULL;
+    x = (x | (x << 1))  & 0x5555555555555555ULL;
+    return x;
+}
+
+static uint32_t quantize(double v, double min, double max) {
+    double scaled = (v - min) / (max - min) * 4294967296.0;
+    if (scaled <= 0) {
+        return 0;
+    }
+    if (scaled >= 4294967295.0) {
+        return 0xFFFFFFFFu;
+    }
+    return (uint32_t)scaled;
+}
+
+/**
+ * y bits sit above x bits, so the two-bit digit at each level is
+ * 0 = botLeft, 1 = botRight, 2 = topLeft, 3 = topRight.
+ */
+uint64_t mortonKey(double x, double y, Quadrant &bounds) {
+    uint32_t qx = quantize(x, bounds.getXMin(), bounds.getXMax());
+    uint32_t qy = quantize(y, bounds.getYMin(), bounds.getYMax());
+    return spreadBits(qx) | (spreadBits(qy) << 1);
+}
+
+// level 0 picks the root's child
+int mortonDigit(uint64_t key, int level) {
+    return (key >> (2 * (MORTON_BITS - 1 - level))) & 3;
+}
+
+/**
+ * LSD radix sort on 8 bit digits. Carries `order` along with the keys and
+ * skips any pass where every key has the same digit.
+ */
+void radixSort(std::vector<uint64_t> &keys, std::vector<int> &order) {
+    unsigned int n = keys.size();
+    std::vector<uint64_t> keyTmp(n);
+    std::vector<int> orderTmp(n);
+    for (int shift = 0; shift < 64; shift += 8) {
+        unsigned int counts[257] = {0};
+        for (unsigned int i = 0; i < n; i++) {
+            counts[((keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        bool trivial = false;
+        for (int d = 1; d <= 256; d++) {
+            if (counts[d] == n) {
+                trivial = true;
+            }
+            counts[d] += counts[d - 1];
+        }
+        if (trivial) {
+            continue;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int dst = counts[(keys[i] >> shift) & 0xFF]++;
+            keyTmp[dst] = keys[i];
+            orderTmp[dst] = order[i];
+        }
+        keys.swap(keyTmp);
+        order.swap(orderTmp);
+    }
+}
+
+/**
+ * Reorders bodies along the Z curve of `bounds` and leaves their keys in
+ * `keys`. Bodies that QuadTree::insert would drop (no mass or out of
+ * bounds) get m = -1 and are moved behind the sorted ones without a key.
+ * Returns the number of sorted bodies.
+ */
+int sortByMorton(std::vector<Body> &bodies, Quadrant &bounds, std::vector<uint64_t> &keys) {
+    unsigned int n = bodies.size();
+    std::vector<int> order;
+    std::vector<int> dropped;
+    keys.clear();
+    for (unsigned int i = 0; i < n; i++) {
+        Body &body = bodies[i];
+        if (body.m <= 0
+                || body.x > bounds.getXMax() || body.x < bounds.getXMin()
+                || body.y > bounds.getYMax() || body.y < bounds.getYMin()) {
+            body.m = -1.0;
+            dropped.push_back(i);
+            continue;
+        }
+        keys.push_back(mortonKey(body.x, body.y, bounds));
+        order.push_back(i);
+    }
+    radixSort(keys, order);
+
+    int valid = order.size();
+    order.insert(order.end(), dropped.begin(), dropped.end());
+    std::vector<Body> sorted(n);
+    for (unsigned int i = 0; i < n; i++) {
+        sorted[i] = bodies[order[i]];
+    }
+    bodies.swap(sorted);
+    return valid;
+}
@@ -0,0 +1,20 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+#include <vector>
+
+#include "body.h"
+#include "quadrant.h"
+
+// bits per axis, keys are twice as wide
+#define MORTON_BITS 32
+
+uint64_t spreadBits(uint32_t v);
+uint64_t mortonKey(double x, double y, Quadrant &bounds);
+int mortonDigit(uint64_t key, int level);
+
+void radixSort(std::vector<uint64_t> &keys, std::vector<int> &order);
+int sortByMorton(std::vector<Body> &bodies, Quadrant &bounds, std::vector<uint64_t> &keys);
+
+#endif
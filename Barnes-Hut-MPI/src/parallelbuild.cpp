@@ -0,0 +1,169 @@
+#include "parallelbuild.h"
+
+#include <algorithm>
+
+// Creates every cell down to `levels` below node and lists the bottom
+// ones in digit order (botLeft, botRight, topLeft, topRight).
+static void createSkeleton(QuadTree *node, int levels, std::vector<QuadTree *> &bins) {
+    if (levels == 0) {
+        bins.push_back(node);
+        return;
+    }
+    NodeArena *arena = node->arena;
+    node->botLeft = arena->newNode(node->quadrant.botLeft());
+    node->botRight = arena->newNode(node->quadrant.botRight());
+    node->topLeft = arena->newNode(node->quadrant.topLeft());
+    node->topRight = arena->newNode(node->quadrant.topRight());
+    createSkeleton(node->botLeft, levels - 1, bins);
+    createSkeleton(node->botRight, levels - 1, bins);
+    createSkeleton(node->topLeft, levels - 1, bins);
+    createSkeleton(node->topRight, levels - 1, bins);
+}
+
+static void gather(QuadTree *node, std::vector<Body *> &bodies) {
+    if (node == nullptr || node->bodyCount == 0) {
+        return;
+    }
+    if (node->bucket != nullptr) {
+        bodies.insert(bodies.end(), node->bucket->bodies, node->bucket->bodies + node->bodyCount);
+    } else if (node->bodyCount == 1) {
+        bodies.push_back(node->body);
+    } else {
+        gather(node->botLeft, bodies);
+        gather(node->botRight, bodies);
+        gather(node->topLeft, bodies);
+        gather(node->topRight, bodies);
+    }
+}
+
+/**
+ * Serial upward pass over the skeleton, whose bottom cells already have
+ * their mass. Turns each skeleton cell into what insert() would have left
+ * there: empty children dropped, a cell with no more bodies than a leaf
+ * holds made that leaf, otherwise an effective body summed from the
+ * children.
+ */
+static void finishSkeleton(QuadTree *node, int levels) {
+    if (levels == 0) {
+        return;
+    }
+    QuadTree **children[4] = { &node->botLeft, &node->botRight, &node->topLeft, &node->topRight };
+    int count = 0;
+    QuadTree *only = nullptr;
+    for (int c = 0; c < 4; c++) {
+        QuadTree *child = *children[c];
+        finishSkeleton(child, levels - 1);
+        if (child->bodyCount == 0) {
+            *children[c] = nullptr;
+            continue;
+        }
+        only = child;
+        count += child->bodyCount;
+    }
+    node->bodyCount = count;
+    int capacity = node->arena->leafCapacity;
+    if (capacity > 1 && count > 0 && count <= capacity) {
+        // refilled in input order, which is the order insert() saw them in
+        std::vector<Body *> leaf;
+        gather(node, leaf);
+        std::sort(leaf.begin(), leaf.end());
+        node->botLeft = node->botRight = node->topLeft = node->topRight = nullptr;
+        node->body = nullptr;
+        node->bodyCount = 0;
+        for (unsigned int k = 0; k < leaf.size(); k++) {
+            node->insert(leaf[k], false);
+        }
+        node->computeMass();
+    } else if (count == 1) {
+        node->body = only->body;
+        for (int c = 0; c < 4; c++) {
+            *children[c] = nullptr;
+        }
+    } else if (count > 1) {
+        node->effective = *only->body;
+        node->effective.index = -1;
+        node->body = &node->effective;
+        node->sumChildren();
+    }
+}
+
+/**
+ * Builds the same tree as inserting every body into a root over `bounds`,
+ * spread over the pool's threads:
+ *
+ *  1. the top `levels` of cells are created up front (4^levels bins),
+ *  2. bodies are routed to their bin with the same halving tests insert()
+ *     uses, in parallel,
+ *  3. each bin's subtree is grown by one thread from that thread's own
+ *     arena, inserting without the incremental centre of mass update,
+ *  4. each bin gets its mass in a parallel upward pass, and the few
+ *     skeleton cells above the bins are finished serially.
+ *
+ * `arena` holds the skeleton, `arenas` needs one arena per thread.
+ */
+QuadTree *buildTreeParallel(NodeArena &arena, std::vector<std::unique_ptr<NodeArena>> &arenas,
+        std::vector<Body> &bodies, Quadrant &bounds, ThreadPool &pool) {
+    int levels = 1;
+    while ((1 << (2 * levels)) < 8 * pool.size() && levels < 6) {
+        levels++;
+    }
+    QuadTree *root = arena.newNode(bounds);
+    std::vector<QuadTree *> bins;
+    createSkeleton(root, levels, bins);
+
+    int n = bodies.size();
+    std::vector<int> binOf(n);
+    pool.parallelFor(n, 1024, [&](int i, int thread) {
+        Body &body = bodies[i];
+        if (body.m <= 0
+                || body.x > bounds.getXMax() || body.x < bounds.getXMin()
+                || body.y > bounds.getYMax() || body.y < bounds.getYMin()) {
+            // same as QuadTree::insert
+            body.m = -1.0;
+            binOf[i] = -1;
+            return;
+        }
+        Quadrant quadrant = bounds;
+        int bin = 0;
+        for (int l = 0; l < levels; l++) {
+            bool right = body.x >= quadrant.getXHalfway();
+            bool top = body.y >= quadrant.getYHalfway();
+            bin = 4 * bin + 2 * top + right;
+            if (top) {
+                quadrant = right ? quadrant.topRight() : quadrant.topLeft();
+            } else {
+                quadrant = right ? quadrant.botRight() : quadrant.botLeft();
+            }
+        }
+        binOf[i] = bin;
+    });
+
+    // counting sort keeps each bin's bodies in input order
+    std::vector<int> start(bins.size() + 1, 0);
+    for (int i = 0; i < n; i++) {
+        if (binOf[i] >= 0) {
+            start[binOf[i] + 1]++;
+        }
+    }
+    for (unsigned int b = 0; b < bins.size(); b++) {
+        start[b + 1] += start[b];
+    }
+    std::vector<int> order(start[bins.size()]);
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for (int i = 0; i < n; i++) {
+        if (binOf[i] >= 0) {
+            order[fill[binOf[i]]++] = i;
+        }
+    }
+
+    pool.parallelFor(bins.size(), 1, [&](int b, int thread) {
+        QuadTree *bin = bins[b];
+        bin->arena = arenas[thread].get();
+        for (int k = start[b]; k < start[b + 1]; k++) {
+            bin->insert(&bodies[order[k]], false);
+        }
+        bin->computeMass();
+    });
+    finishSkeleton(root, levels);
+    return root;
+}
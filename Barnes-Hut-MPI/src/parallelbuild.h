@@ -0,0 +1,14 @@
+#ifndef PARALLELBUILD_H
+#define PARALLELBUILD_H
+
+#include <memory>
+#include <vector>
+
+#include "body.h"
+#include "quadtree.h"
+#include "threadpool.h"
+
+QuadTree *buildTreeParallel(NodeArena &arena, std::vector<std::unique_ptr<NodeArena>> &arenas,
+        std::vector<Body> &bodies, Quadrant &bounds, ThreadPool &pool);
+
+#endif
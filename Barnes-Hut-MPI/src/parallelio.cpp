@@ -0,0 +1,110 @@
+#include "parallelio.h"
+#include "io.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+// a Body exactly as it is stored in the file
+static MPI_Datatype recordType() {
+    MPI_Datatype record;
+    MPI_Type_contiguous(sizeof(Body), MPI_BYTE, &record);
+    MPI_Type_commit(&record);
+    return record;
+}
+
+bool readBodiesParallel(const char *fileName, std::vector<Body> &local, int &total,
+        int rank, int size) {
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        return false;
+    }
+    BodyFileHeader header = {};
+    MPI_Offset length;
+    MPI_File_get_size(file, &length);
+    MPI_File_read_at_all(file, 0, &header, std::min<MPI_Offset>(sizeof(header), length), MPI_BYTE,
+            MPI_STATUS_IGNORE);
+    // body counts and indices are ints everywhere else
+    if (!validHeader(header, sizeof(Body), length) || header.count > INT_MAX) {
+        MPI_File_close(&file);
+        return false;
+    }
+
+    total = header.count;
+    long count = total / size + (rank < total % size ? 1 : 0);
+    long first = (long)rank * (total / size) + std::min(rank, total % size);
+    local.resize(count);
+
+    MPI_Datatype record = recordType();
+    MPI_File_read_at_all(file, header.headerSize + first * sizeof(Body),
+            local.data(), count, record, MPI_STATUS_IGNORE);
+    MPI_Type_free(&record);
+    MPI_File_close(&file);
+    return true;
+}
+
+bool writeBodiesParallel(const char *fileName, std::vector<Body> &local, int total,
+        int64_t step, double dt, double theta, int rank, int size) {
+    ParallelWrite write;
+    if (!startWriteParallel(fileName, local, total, step, dt, theta, rank, size, write)) {
+        return false;
+    }
+    finishWriteParallel(write);
+    return true;
+}
+
+bool startWriteParallel(const char *fileName, std::vector<Body> &local, int total,
+        int64_t step, double dt, double theta, int rank, int size, ParallelWrite &write) {
+    std::sort(local.begin(), local.end(),
+            [](const Body &a, const Body &b) { return a.index < b.index; });
+    int bad = !local.empty() && (local.front().index < 0 || local.back().index >= total);
+    int anyBad;
+    MPI_Allreduce(&bad, &anyBad, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (anyBad) {
+        return false;
+    }
+
+    BodyFileHeader header = makeHeader(total, step, dt, theta);
+    int failed = MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+            &write.file) != MPI_SUCCESS;
+    int anyFailed;
+    MPI_Allreduce(&failed, &anyFailed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (anyFailed) {
+        if (!failed) {
+            MPI_File_close(&write.file);
+        }
+        return false;
+    }
+    MPI_File_set_size(write.file, header.headerSize + (MPI_Offset)total * sizeof(Body));
+    if (rank == 0) {
+        MPI_File_write_at(write.file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+
+    // the file view scatters this rank's records to their index
+    write.record = recordType();
+    std::vector<int> displs(local.size());
+    for (unsigned int j = 0; j < local.size(); j++) {
+        displs[j] = local[j].index;
+    }
+    MPI_Type_create_indexed_block(displs.size(), 1, displs.data(), write.record, &write.placed);
+    MPI_Type_commit(&write.placed);
+    MPI_File_set_view(write.file, header.headerSize, write.record, write.placed, "native", MPI_INFO_NULL);
+    MPI_File_iwrite_all(write.file, local.data(), local.size(), write.record, &write.request);
+    return true;
+}
+
+void finishWriteParallel(ParallelWrite &write) {
+    MPI_Wait(&write.request, MPI_STATUS_IGNORE);
+    MPI_Type_free(&write.placed);
+    MPI_Type_free(&write.record);
+    MPI_File_close(&write.file);
+}
+
+void bcastString(std::string &str, int rank) {
+    int length = str.size();
+    MPI_Bcast(&length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        str.resize(length);
+    }
+    MPI_Bcast(&str[0], length, MPI_CHAR, 0, MPI_COMM_WORLD);
+}
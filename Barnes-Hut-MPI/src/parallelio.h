@@ -0,0 +1,46 @@
+#ifndef PARALLELIO_H
+#define PARALLELIO_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+
+/**
+ * Collective MPI-IO on binary body files (io.h), for distributed mode.
+ * No rank ever holds more than its own bodies.
+ */
+
+// Every rank reads the same even slice scatterBodies would have sent it.
+// `total` is set to the number of bodies in the file. Returns false, on
+// every rank, if the file can't be opened, isn't a binary body file, is
+// shorter than its header says or holds more than INT_MAX bodies.
+bool readBodiesParallel(const char *fileName, std::vector<Body> &local, int &total,
+        int rank, int size);
+
+// Every rank writes its bodies at their index, so the file comes out in
+// index order without a gather. Returns false, without writing, if some
+// index is not in [0, total) or the file can't be opened on every rank.
+bool writeBodiesParallel(const char *fileName, std::vector<Body> &local, int total,
+        int64_t step, double dt, double theta, int rank, int size);
+
+// A collective write in flight, see startWriteParallel.
+struct ParallelWrite {
+    MPI_File file;
+    MPI_Datatype record;
+    MPI_Datatype placed;
+    MPI_Request request;
+};
+
+// Nonblocking writeBodiesParallel: the write proceeds during later MPI
+// calls, and `local` must stay untouched until finishWriteParallel, which
+// every rank has to call.
+bool startWriteParallel(const char *fileName, std::vector<Body> &local, int total,
+        int64_t step, double dt, double theta, int rank, int size, ParallelWrite &write);
+void finishWriteParallel(ParallelWrite &write);
+
+void bcastString(std::string &str, int rank);
+
+#endif
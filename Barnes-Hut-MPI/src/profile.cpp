@@ -0,0 +1,105 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <iomanip>
+
+static const char *metricNames[] = {
+    "tree", "force", "integrate", "comm", "io", "visited", "accepted", "leaf"
+};
+
+Profile::Profile(const char *name, int rank, int size)
+        : on(name != nullptr), rank(rank), size(size), steps(0) {
+    std::fill(current, current + metrics, 0.0);
+    std::fill(totals, totals + metrics, 0.0);
+    if (on && rank == 0) {
+        jsonName = std::string(name) + ".json";
+        csv.open(std::string(name) + ".csv", std::ofstream::trunc);
+        // counts run into the billions
+        csv << std::setprecision(10);
+        csv << "step";
+        for (int k = 0; k < metrics; k++) {
+            csv << ',' << metricNames[k] << "_min," << metricNames[k] << "_max,"
+                    << metricNames[k] << "_mean";
+        }
+        csv << '\n';
+    }
+}
+
+bool Profile::enabled() {
+    return on;
+}
+
+void Profile::add(int phase, double seconds) {
+    current[phase] += seconds;
+}
+
+void Profile::add(const WalkCounts &counts) {
+    current[PHASES] += counts.visited;
+    current[PHASES + 1] += counts.accepted;
+    current[PHASES + 2] += counts.leaf;
+}
+
+void Profile::gather(double *values, std::vector<double> &summary) {
+    std::vector<double> all(rank == 0 ? metrics * size : 0);
+    MPI_Gather(values, metrics, MPI_DOUBLE, all.data(), metrics, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        return;
+    }
+    summary.assign(3 * metrics, 0.0);
+    for (int k = 0; k < metrics; k++) {
+        double lo = all[k], hi = all[k], sum = 0;
+        for (int r = 0; r < size; r++) {
+            lo = std::min(lo, all[r * metrics + k]);
+            hi = std::max(hi, all[r * metrics + k]);
+            sum += all[r * metrics + k];
+        }
+        summary[3 * k] = lo;
+        summary[3 * k + 1] = hi;
+        summary[3 * k + 2] = sum / size;
+    }
+}
+
+void Profile::endStep(int step) {
+    for (int k = 0; k < metrics; k++) {
+        totals[k] += current[k];
+    }
+    steps++;
+    if (on) {
+        std::vector<double> summary;
+        gather(current, summary);
+        if (rank == 0) {
+            csv << step;
+            for (unsigned int k = 0; k < summary.size(); k++) {
+                csv << ',' << summary[k];
+            }
+            csv << '\n';
+        }
+    }
+    std::fill(current, current + metrics, 0.0);
+}
+
+void Profile::finish() {
+    // anything added after the last step, such as the output file
+    for (int k = 0; k < metrics; k++) {
+        totals[k] += current[k];
+    }
+    if (!on) {
+        return;
+    }
+    std::vector<double> summary;
+    gather(totals, summary);
+    if (rank != 0) {
+        return;
+    }
+    csv.close();
+    std::ofstream json(jsonName, std::ofstream::trunc);
+    json << std::setprecision(10);
+    json << "{\n  \"ranks\": " << size << ",\n  \"steps\": " << steps;
+    for (int k = 0; k < metrics; k++) {
+        double mean = summary[3 * k + 2];
+        json << ",\n  \"" << metricNames[k] << "\": { \"min\": " << summary[3 * k]
+                << ", \"max\": " << summary[3 * k + 1] << ", \"mean\": " << mean
+                << ", \"imbalance\": " << (mean > 0 ? summary[3 * k + 1] / mean : 1.0) << " }";
+    }
+    json << "\n}\n";
+}
@@ -0,0 +1,61 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mpi.h"
+#include "helpers.h"
+
+// where a step's time goes
+enum {
+    PHASE_TREE = 0,     // bounds, sorting, building or refitting trees
+    PHASE_FORCE,        // force walks, FMM passes and diagnostic potentials
+    PHASE_INTEGRATE,    // moving bodies
+    PHASE_COMM,         // waiting on body exchanges and broadcasts
+    PHASE_IO,           // checkpoints, trajectories, diagnostics, output
+    PHASES
+};
+
+/**
+ * Per-phase times and walk counts (--profile). Every rank adds its own up
+ * over a step; endStep() gathers them onto rank 0, which writes the min,
+ * max and mean over ranks to `<name>.csv`, one line per step. finish()
+ * does the same for the totals of the whole run as `<name>.json`, with
+ * max / mean as the imbalance of each.
+ *
+ * Without a name nothing is gathered or written, and walks are given no
+ * counts to fill in.
+ */
+class Profile {
+public:
+    Profile(const char *name, int rank, int size);
+
+    bool enabled();
+
+    void add(int phase, double seconds);
+    void add(const WalkCounts &counts);
+
+    // collective when enabled
+    void endStep(int step);
+    void finish();
+
+private:
+    static const int metrics = PHASES + 3;
+
+    bool on;
+    int rank;
+    int size;
+    int steps;
+    std::string jsonName;
+    std::ofstream csv;
+    // this step's numbers and the run's, phases first, then the counts
+    double current[metrics];
+    double totals[metrics];
+
+    // min, max and mean of each metric over the ranks, on rank 0
+    void gather(double *values, std::vector<double> &summary);
+};
+
+#endif
@@ -27,17 +27,17 @@ double Quadrant::getYMax(){
     return yMax;
 }
 
-Quadrant* Quadrant::newTopLeft(){
-    return new Quadrant(xMin, getYHalfway(), getXHalfway(), yMax);
+Quadrant Quadrant::topLeft(){
+    return Quadrant(xMin, getYHalfway(), getXHalfway(), yMax);
 }
-Quadrant* Quadrant::newTopRight(){
-    return new Quadrant(getXHalfway(), getYHalfway(), xMax, yMax);
+Quadrant Quadrant::topRight(){
+    return Quadrant(getXHalfway(), getYHalfway(), xMax, yMax);
 }
-Quadrant* Quadrant::newBotLeft(){
-    return new Quadrant(xMin, yMin, getXHalfway(), getYHalfway());
+Quadrant Quadrant::botLeft(){
+    return Quadrant(xMin, yMin, getXHalfway(), getYHalfway());
 }
-Quadrant* Quadrant::newBotRight(){
-    return new Quadrant(getXHalfway(), yMin, xMax, getYHalfway());
+Quadrant Quadrant::botRight(){
+    return Quadrant(getXHalfway(), yMin, xMax, getYHalfway());
 }
 
 void Quadrant::print() {
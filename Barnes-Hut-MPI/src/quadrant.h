@@ -24,10 +24,10 @@ public:
     double getXMax();
     double getYMax();
 
-    Quadrant* newTopLeft();
-    Quadrant* newTopRight();
-    Quadrant* newBotLeft();
-    Quadrant* newBotRight();
+    Quadrant topLeft();
+    Quadrant topRight();
+    Quadrant botLeft();
+    Quadrant botRight();
     void print();
 };
 
@@ -1,32 +1,5 @@
 #include "quadtree.h"
-
-QuadTree::QuadTree(double xDim, double yDim){
-    quadrant = new Quadrant(0.0, 0.0, xDim, yDim);
-    bodyCount = 0;
-}
-
-QuadTree::~QuadTree(){
-    if(topRight != nullptr){
-        // topRight->~QuadTree();
-        delete topRight;
-    }
-    if(botRight != nullptr) {
-        // botRight->~QuadTree();
-        delete botRight;
-    }
-    if(topLeft != nullptr){
-        // topLeft->~QuadTree();
-        delete topLeft;
-    }
-    if(botLeft != nullptr){
-        // botLeft->~QuadTree();
-        delete botLeft;
-    }
-    delete quadrant;
-    if(bodyCount > 1) {
-        free(body);
-    }
-}
+#include "kernels.h"
 
 QuadTree *QuadTree::getTopLeft(){
     return topLeft;
@@ -45,7 +18,7 @@ QuadTree *QuadTree::getBotRight(){
 }
 
 Quadrant *QuadTree::getQuadrant() {
-    return quadrant;
+    return &quadrant;
 }
 
 Body *QuadTree::getBody(){
@@ -56,21 +29,29 @@ void QuadTree::setBody(Body *body) {
     this->body = body;
 }
 
-void QuadTree::insert(Body *newBody){
+/**
+ * Without updateMass internal nodes are left with a stale centre of mass
+ * until computeMass() is run over the finished tree.
+ */
+void QuadTree::insert(Body *newBody, bool updateMass){
     if (newBody->m <= 0) {
         // std::cout << "    0 mass" << std::endl;
         newBody->m = -1.0;
         return;
     }
-    if(newBody->x > quadrant->getXMax() 
-            || newBody->x < quadrant->getXMin() 
-            || newBody->y > quadrant->getYMax()
-            || newBody->y < quadrant->getYMin() ){
+    if(newBody->x > quadrant.getXMax() 
+            || newBody->x < quadrant.getXMin() 
+            || newBody->y > quadrant.getYMax()
+            || newBody->y < quadrant.getYMin() ){
 
         // std::cout << "    outside of range" << std::endl;
         newBody->m = -1.0;
         return;
     }
+    if (arena->leafCapacity > 1) {
+        insertIntoBucket(newBody, updateMass);
+        return;
+    }
     if (bodyCount == 0) {
         this->body = newBody;
         bodyCount++;
@@ -79,13 +60,71 @@ void QuadTree::insert(Body *newBody){
         // create new sub tree
         // createChildren();
         // std::cout << "    moving " << this->body->getIndex() << " into child Tree" << std::endl;
-        insertBodyIntoChild(this->body);
-        Body *temp = clone(this->body);
-        this->body = temp;
+        insertBodyIntoChild(this->body, updateMass);
+        effective = *this->body;
+        effective.index = -1;
+        this->body = &effective;
     }
     // std::cout << "    inserting " << newBody->getIndex() <<" as a child" << std::endl;
-    insertBodyIntoChild(newBody);
-    updateEffectiveBody(newBody);
+    insertBodyIntoChild(newBody, updateMass);
+    if (updateMass) {
+        updateEffectiveBody(newBody);
+    }
+    bodyCount++;
+}
+
+/**
+ * insert() for leaves holding up to arena->leafCapacity bodies. A full
+ * leaf hands its bodies down to new children and becomes an ordinary
+ * internal node; one too small to split any further in floating point
+ * (coincident bodies) grows its bucket instead.
+ */
+void QuadTree::insertIntoBucket(Body *newBody, bool updateMass) {
+    if (bodyCount == 0) {
+        bucket = arena->newBucket(arena->leafCapacity);
+    }
+    if (bucket != nullptr && bodyCount == bucket->capacity) {
+        double xMid = quadrant.getXHalfway();
+        double yMid = quadrant.getYHalfway();
+        bool splittable = xMid > quadrant.getXMin() && xMid < quadrant.getXMax()
+                && yMid > quadrant.getYMin() && yMid < quadrant.getYMax();
+        if (splittable) {
+            for (int k = 0; k < bodyCount; k++) {
+                insertBodyIntoChild(bucket->bodies[k], updateMass);
+            }
+            bucket = nullptr;
+        } else {
+            LeafBucket *grown = arena->newBucket(2 * bucket->capacity);
+            for (int k = 0; k < bodyCount; k++) {
+                grown->bodies[k] = bucket->bodies[k];
+                grown->x[k] = bucket->x[k];
+                grown->y[k] = bucket->y[k];
+                grown->m[k] = bucket->m[k];
+            }
+            bucket = grown;
+        }
+    }
+
+    if (bucket != nullptr) {
+        bucket->bodies[bodyCount] = newBody;
+        bucket->x[bodyCount] = newBody->x;
+        bucket->y[bodyCount] = newBody->y;
+        bucket->m[bodyCount] = newBody->m;
+    } else {
+        insertBodyIntoChild(newBody, updateMass);
+    }
+    if (bodyCount == 0) {
+        body = newBody;
+    } else {
+        if (bodyCount == 1) {
+            effective = *body;
+            effective.index = -1;
+            body = &effective;
+        }
+        if (updateMass) {
+            updateEffectiveBody(newBody);
+        }
+    }
     bodyCount++;
 }
 
@@ -93,48 +132,41 @@ int QuadTree::getBodyCount() {
     return bodyCount;
 }
 
-// void QuadTree::createChildren() {
-//     topLeft = new QuadTree(quadrant->newTopLeft());
-//     topRight = new QuadTree(quadrant->newTopRight());
-//     botLeft = new QuadTree(quadrant->newBotLeft());
-//     botRight = new QuadTree(quadrant->newBotRight());
-// }
-
-void QuadTree::insertBodyIntoChild(Body *newBody) {
+void QuadTree::insertBodyIntoChild(Body *newBody, bool updateMass) {
     // std::cout << "        { " << newBody->getX() << ", " << newBody->getY() << " } ";
-    double xMid = quadrant->getXHalfway(); // botLeft->getQuadrant()->getXMax()
-    double yMid = quadrant->getYHalfway(); // botLeft->getQuadrant()->getYMax()
+    double xMid = quadrant.getXHalfway(); // botLeft->getQuadrant()->getXMax()
+    double yMid = quadrant.getYHalfway(); // botLeft->getQuadrant()->getYMax()
     if (newBody->x < xMid) {
         // left side
         if (newBody->y < yMid) {
             // bottom
             // botLeft->getQuadrant()->print();
             if(botLeft == nullptr) {
-                botLeft = new QuadTree(quadrant->newBotLeft());
+                botLeft = arena->newNode(quadrant.botLeft());
             }
-            botLeft->insert(newBody);
+            botLeft->insert(newBody, updateMass);
         } else {
             // top
             if(topLeft == nullptr) {
-                topLeft = new QuadTree(quadrant->newTopLeft());
+                topLeft = arena->newNode(quadrant.topLeft());
             }
             
-            topLeft->insert(newBody);
+            topLeft->insert(newBody, updateMass);
         }
     } else {
         // right side
         if (newBody->y < yMid) {
             // bottom
             if(botRight == nullptr) {
-                botRight = new QuadTree(quadrant->newBotRight());
+                botRight = arena->newNode(quadrant.botRight());
             }
-            botRight->insert(newBody);
+            botRight->insert(newBody, updateMass);
         } else {
             // top
             if(topRight == nullptr) {
-                topRight = new QuadTree(quadrant->newTopRight());
+                topRight = arena->newNode(quadrant.topRight());
             }
-            topRight->insert(newBody);
+            topRight->insert(newBody, updateMass);
         }
     }
 }
@@ -161,48 +193,186 @@ void QuadTree::updateEffectiveBody(Body *newBody) {
     body->m =(m);
 }
 
-std::pair<double, double> QuadTree::calcForceOn(Body *theBody, double theta) {
-    if (bodyCount == 0) {
-        // empty node. 
-        return {0.0, 0.0};
-    } 
-    if (bodyCount == 1) {
-        if (body->index == theBody->index){
-            return {0.0, 0.0};
-        } 
-        return calcF(theBody, body);
-    }
-    // internal node...
-    double s = quadrant->getXMax() - quadrant->getXMin();
-    double xDiff = body->x - theBody->x;
-    double yDiff = body->y - theBody->y;
-    double d = sqrt((xDiff * xDiff) + (yDiff * yDiff));
-    if(checkMAC(s,d, theta)) {
-        return calcF(theBody, body);
-    } else {
-        double resX = 0, resY = 0, tempX, tempY;
-        if (botLeft != nullptr) {
-            std::tie(tempX, tempY) = botLeft->calcForceOn(theBody, theta);
-            resX += tempX;
-            resY += tempY;
+// Upward pass: sets every internal node's effective body from its children.
+void QuadTree::computeMass() {
+    if (bodyCount <= 1) {
+        return;
+    }
+    if (bucket != nullptr) {
+        sumBucket();
+        return;
+    }
+    QuadTree *children[4] = { botLeft, botRight, topLeft, topRight };
+    for (int c = 0; c < 4; c++) {
+        if (children[c] != nullptr && children[c]->bodyCount > 0) {
+            children[c]->computeMass();
+        }
+    }
+    sumChildren();
+}
+
+/**
+ * Sets the effective body, the quadrupole moments and the reach from the
+ * children, which must already have theirs. Each child's moments are
+ * shifted to this node's centre of mass (parallel axis) before being added.
+ */
+void QuadTree::sumChildren() {
+    double x = 0, y = 0, m = 0;
+    QuadTree *children[4] = { botLeft, botRight, topLeft, topRight };
+    for (int c = 0; c < 4; c++) {
+        if (children[c] == nullptr || children[c]->bodyCount == 0) {
+            continue;
+        }
+        Body *child = children[c]->body;
+        m += child->m;
+        x += child->x * child->m;
+        y += child->y * child->m;
+    }
+    effective.x = x / m;
+    effective.y = y / m;
+    effective.m = m;
+
+    qxx = qxy = qyy = 0;
+    reach = 0;
+    for (int c = 0; c < 4; c++) {
+        if (children[c] == nullptr || children[c]->bodyCount == 0) {
+            continue;
         }
-        if (botRight != nullptr) {
-            std::tie(tempX, tempY) = botRight->calcForceOn(theBody, theta);
-            resX += tempX;
-            resY += tempY;
+        Body *child = children[c]->body;
+        double sx = child->x - effective.x;
+        double sy = child->y - effective.y;
+        qxx += children[c]->qxx + child->m * (2 * sx * sx - sy * sy);
+        qxy += children[c]->qxy + child->m * 3 * sx * sy;
+        qyy += children[c]->qyy + child->m * (2 * sy * sy - sx * sx);
+        reach = std::max(reach, sqrt(sx * sx + sy * sy) + children[c]->reach);
+    }
+}
+
+// sumChildren() for a leaf bucket, straight from its bodies
+void QuadTree::sumBucket() {
+    double x = 0, y = 0, m = 0;
+    for (int k = 0; k < bodyCount; k++) {
+        m += bucket->m[k];
+        x += bucket->x[k] * bucket->m[k];
+        y += bucket->y[k] * bucket->m[k];
+    }
+    effective.x = x / m;
+    effective.y = y / m;
+    effective.m = m;
+
+    qxx = qxy = qyy = 0;
+    reach = 0;
+    for (int k = 0; k < bodyCount; k++) {
+        double sx = bucket->x[k] - effective.x;
+        double sy = bucket->y[k] - effective.y;
+        qxx += bucket->m[k] * (2 * sx * sx - sy * sy);
+        qxy += bucket->m[k] * 3 * sx * sy;
+        qyy += bucket->m[k] * (2 * sy * sy - sx * sx);
+        reach = std::max(reach, sqrt(sx * sx + sy * sy));
+    }
+}
+
+/**
+ * Walks the tree with an explicit stack rather than recursing, visiting
+ * children in the same order as the old recursive walk (botLeft, botRight,
+ * topLeft, topRight) and summing into a single accumulator. The number of
+ * interactions is left in theBody->cost. A leaf bucket that fails the MAC
+ * goes through accumulateAccel in one go.
+ */
+std::pair<double, double> QuadTree::calcForceOn(Body *theBody, double theta, bool quadrupole,
+        WalkCounts *counts, double *potential) {
+    static thread_local std::vector<QuadTree *> stack;
+    stack.clear();
+    stack.push_back(this);
+
+    double resX = 0, resY = 0;
+    int interactions = 0;
+    int visited = 0, leaf = 0;
+    while (!stack.empty()) {
+        QuadTree *node = stack.back();
+        stack.pop_back();
+        if (node->bodyCount == 0) {
+            // empty node.
+            continue;
         }
-        if (topLeft != nullptr) {
-            std::tie(tempX, tempY) = topLeft->calcForceOn(theBody, theta);
-            resX += tempX;
-            resY += tempY;
+        visited++;
+        Body *body = node->body;
+        if (node->bodyCount == 1) {
+            if (body->index == theBody->index) {
+                continue;
+            }
+        } else {
+            // internal node...
+            double s = node->quadrant.getXMax() - node->quadrant.getXMin();
+            double xDiff = body->x - theBody->x;
+            double yDiff = body->y - theBody->y;
+            double d = sqrt((xDiff * xDiff) + (yDiff * yDiff));
+            if (!checkMAC(s, d, theta) || (quadrupole && !clearOfSoftening(node->reach, d, d))) {
+                if (node->bucket != nullptr) {
+                    // a body meets itself at distance 0, which adds exactly 0
+                    double ax = 0, ay = 0;
+                    accumulateAccel(theBody->x, theBody->y, node->bucket->x, node->bucket->y,
+                            node->bucket->m, node->bodyCount, ax, ay);
+                    resX += theBody->m * ax;
+                    resY += theBody->m * ay;
+                    LeafBucket *bucket = node->bucket;
+                    for (int k = 0; k < node->bodyCount && potential != nullptr; k++) {
+                        // unlike the force, a body's own term is not 0
+                        if (bucket->bodies[k]->index != theBody->index) {
+                            double xDiff = bucket->x[k] - theBody->x;
+                            double yDiff = bucket->y[k] - theBody->y;
+                            *potential += calcPotential(theBody->m, bucket->m[k],
+                                    sqrt((xDiff * xDiff) + (yDiff * yDiff)));
+                        }
+                    }
+                    interactions += node->bodyCount;
+                    leaf += node->bodyCount;
+                    continue;
+                }
+                // pushed in reverse so botLeft is handled first
+                if (node->topRight != nullptr) {
+                    stack.push_back(node->topRight);
+                }
+                if (node->topLeft != nullptr) {
+                    stack.push_back(node->topLeft);
+                }
+                if (node->botRight != nullptr) {
+                    stack.push_back(node->botRight);
+                }
+                if (node->botLeft != nullptr) {
+                    stack.push_back(node->botLeft);
+                }
+                continue;
+            }
         }
-        if (topRight != nullptr) {
-            std::tie(tempX, tempY) = topRight->calcForceOn(theBody, theta);
-            resX += tempX;
-            resY += tempY;
+        double tempX, tempY;
+        std::tie(tempX, tempY) = calcF(theBody, body);
+        if (quadrupole && node->bodyCount > 1) {
+            double ax = 0, ay = 0;
+            addQuadrupole(body->x - theBody->x, body->y - theBody->y,
+                    node->qxx, node->qxy, node->qyy, ax, ay);
+            tempX += theBody->m * ax;
+            tempY += theBody->m * ay;
         }
-        return {resX, resY};
+        resX += tempX;
+        resY += tempY;
+        if (potential != nullptr) {
+            double xDiff = body->x - theBody->x;
+            double yDiff = body->y - theBody->y;
+            *potential += calcPotential(theBody->m, body->m, sqrt((xDiff * xDiff) + (yDiff * yDiff)));
+        }
+        interactions++;
+        if (node->bodyCount == 1) {
+            leaf++;
+        }
+    }
+    theBody->cost = interactions;
+    if (counts != nullptr) {
+        counts->visited += visited;
+        counts->accepted += interactions - leaf;
+        counts->leaf += leaf;
     }
+    return {resX, resY};
 }
 
 
@@ -7,23 +7,38 @@
 #include "body.h"
 #include "quadrant.h"
 #include "helpers.h"
+#include "arena.h"
 
+/**
+ * Nodes live in a NodeArena and are released all at once by
+ * NodeArena::reset(), so there is nothing to delete per node.
+ */
 class QuadTree {
 public:
-    Body *body;
+    // points at the leaf's body, or at `effective` once the node has children
+    Body *body = nullptr;
+    Body effective;
+    // quadrupole moments about the centre of mass, set by computeMass()
+    double qxx = 0;
+    double qxy = 0;
+    double qyy = 0;
+    // no body is further than this from the centre of mass
+    double reach = 0;
+    // a leaf's bodies when the arena's leafCapacity is above 1, else null
+    LeafBucket *bucket = nullptr;
     QuadTree *topLeft = nullptr;
     QuadTree *topRight = nullptr;
     QuadTree *botLeft = nullptr;
     QuadTree *botRight = nullptr;
-    Quadrant *quadrant;
+    Quadrant quadrant;
+    NodeArena *arena;
 
     int bodyCount = 0;
-    void createChildren();
-    void insertBodyIntoChild(Body *newBody);
+    void insertBodyIntoChild(Body *newBody, bool updateMass = true);
+    void insertIntoBucket(Body *newBody, bool updateMass);
     void updateEffectiveBody(Body *newBody);
-    QuadTree(Quadrant *quadrant) : quadrant(quadrant) { };
-    QuadTree(double xDim, double yDim);
-    ~QuadTree();
+    QuadTree(NodeArena *arena, const Quadrant &quadrant) : quadrant(quadrant), arena(arena) { };
+    ~QuadTree() = default;
     
     QuadTree *getTopLeft();
     QuadTree *getTopRight();
@@ -36,11 +51,16 @@ public:
     // This might be deleted...
     void setBody(Body *body);
 
-    void insert(Body *newBody);
+    void insert(Body *newBody, bool updateMass = true);
+    void computeMass();
+    void sumChildren();
+    void sumBucket();
 
     void print(int tabLevel);
 
-    std::pair<double, double> calcForceOn(Body *theBody, double theta);
+    // with `potential`, theBody's potential energy from the same walk is added to it
+    std::pair<double, double> calcForceOn(Body *theBody, double theta, bool quadrupole,
+            WalkCounts *counts = nullptr, double *potential = nullptr);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "refit.h"
+
+// same test as QuadTree::insert
+static bool inside(Quadrant &quadrant, Body *body) {
+    return body->x <= quadrant.getXMax() && body->x >= quadrant.getXMin()
+            && body->y <= quadrant.getYMax() && body->y >= quadrant.getYMin();
+}
+
+static void gather(QuadTree *node, std::vector<Body *> &bodies) {
+    if (node == nullptr || node->bodyCount == 0) {
+        return;
+    }
+    if (node->bucket != nullptr) {
+        for (int k = 0; k < node->bodyCount; k++) {
+            bodies.push_back(node->bucket->bodies[k]);
+        }
+    } else if (node->bodyCount == 1) {
+        bodies.push_back(node->body);
+    } else {
+        gather(node->botLeft, bodies);
+        gather(node->botRight, bodies);
+        gather(node->topLeft, bodies);
+        gather(node->topRight, bodies);
+    }
+}
+
+// turns node into a leaf holding exactly `bodies`, dropping its subtree
+static void makeLeaf(QuadTree *node, std::vector<Body *> &bodies) {
+    node->topLeft = node->topRight = node->botLeft = node->botRight = nullptr;
+    node->bucket = nullptr;
+    node->body = nullptr;
+    node->bodyCount = 0;
+    for (unsigned int k = 0; k < bodies.size(); k++) {
+        node->insert(bodies[k], false);
+    }
+}
+
+/**
+ * Step 1 of refitTree: takes out every body that is no longer inside its
+ * leaf and fixes up the counts on the way back up. A cell left with no
+ * more bodies than a leaf holds becomes that leaf.
+ */
+static void collect(QuadTree *node, std::vector<Body *> &escaped, std::vector<Body *> &scratch) {
+    int capacity = node->arena->leafCapacity;
+    if (node->bucket != nullptr) {
+        LeafBucket *bucket = node->bucket;
+        int kept = 0;
+        for (int k = 0; k < node->bodyCount; k++) {
+            Body *body = bucket->bodies[k];
+            if (!inside(node->quadrant, body)) {
+                escaped.push_back(body);
+                continue;
+            }
+            bucket->bodies[kept] = body;
+            bucket->x[kept] = body->x;
+            bucket->y[kept] = body->y;
+            bucket->m[kept] = body->m;
+            kept++;
+        }
+        node->bodyCount = kept;
+        if (kept <= 1) {
+            node->body = kept == 1 ? bucket->bodies[0] : nullptr;
+        }
+        return;
+    }
+    if (node->bodyCount == 1) {
+        // a capacity of 1, where leaves hold their body directly
+        if (!inside(node->quadrant, node->body)) {
+            escaped.push_back(node->body);
+            scratch.clear();
+            makeLeaf(node, scratch);
+        }
+        return;
+    }
+
+    QuadTree *children[4] = { node->botLeft, node->botRight, node->topLeft, node->topRight };
+    int count = 0;
+    for (int c = 0; c < 4; c++) {
+        if (children[c] != nullptr && children[c]->bodyCount > 0) {
+            collect(children[c], escaped, scratch);
+            count += children[c]->bodyCount;
+        }
+    }
+    node->bodyCount = count;
+    if (count <= capacity) {
+        scratch.clear();
+        for (int c = 0; c < 4; c++) {
+            gather(children[c], scratch);
+        }
+        makeLeaf(node, scratch);
+    }
+}
+
+bool refitTree(QuadTree *root, int &moved) {
+    std::vector<Body *> escaped;
+    std::vector<Body *> scratch;
+    moved = 0;
+    if (root->bodyCount > 0) {
+        collect(root, escaped, scratch);
+    }
+    moved = escaped.size();
+    for (unsigned int k = 0; k < escaped.size(); k++) {
+        if (!inside(root->quadrant, escaped[k])) {
+            return false;
+        }
+        root->insert(escaped[k], false);
+    }
+    root->computeMass();
+    return true;
+}
+
+Quadrant refitBounds(Quadrant &bounds) {
+    double margin = REFIT_ROOT_MARGIN * (bounds.getXMax() - bounds.getXMin());
+    return Quadrant(bounds.getXMin() - margin, bounds.getYMin() - margin,
+            bounds.getXMax() + margin, bounds.getYMax() + margin);
+}
+
+static void sumDepth(QuadTree *node, int depth, double &total) {
+    if (node == nullptr || node->bodyCount == 0) {
+        return;
+    }
+    if (node->bucket != nullptr || node->bodyCount == 1) {
+        total += (double)depth * node->bodyCount;
+        return;
+    }
+    sumDepth(node->botLeft, depth + 1, total);
+    sumDepth(node->botRight, depth + 1, total);
+    sumDepth(node->topLeft, depth + 1, total);
+    sumDepth(node->topRight, depth + 1, total);
+}
+
+double meanDepth(QuadTree *root) {
+    double total = 0;
+    sumDepth(root, 0, total);
+    return root->bodyCount > 0 ? total / root->bodyCount : 0;
+}
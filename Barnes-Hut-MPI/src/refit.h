@@ -0,0 +1,45 @@
+#ifndef REFIT_H
+#define REFIT_H
+
+#include <vector>
+
+#include "quadtree.h"
+
+// rebuild once the mean body depth has grown this much since the last build
+#define REFIT_MAX_DEPTH_GROWTH 1.1
+// room a kept tree's root leaves on every side, as a fraction of the bodies' extent
+#define REFIT_ROOT_MARGIN (1.0 / 64)
+
+// how the passes of a --refit run got their tree, reported at the end
+typedef struct RefitCounts {
+    int refits;
+    int scheduled;      // rebuilt because K steps had passed
+    int escaped;        // rebuilt because a body left the root cell
+    int deeper;         // rebuilt because the mean depth grew too much
+} RefitCounts;
+
+/**
+ * Brings a tree built on earlier positions up to date with where its
+ * bodies are now (--refit), instead of building a new one:
+ *
+ *  1. bodies that left their leaf are taken out, and cells left with at
+ *     most one body (or a leaf bucket's worth) collapse back into leaves,
+ *  2. those bodies are inserted again from the root, reusing cells that
+ *     still exist and taking new ones from the cells' own arenas,
+ *  3. every centre of mass, quadrupole moment and reach is recomputed
+ *     bottom up, since all bodies have moved a little.
+ *
+ * Returns false if a body has left the root cell, in which case the tree
+ * is unusable and has to be rebuilt over new bounds. `moved` is set to
+ * the number of bodies that changed leaf.
+ */
+bool refitTree(QuadTree *root, int &moved);
+
+// the root cell for a tree that will be refitted: bounds grown by
+// REFIT_ROOT_MARGIN on every side, so bodies drifting outwards stay inside
+Quadrant refitBounds(Quadrant &bounds);
+
+// mean depth of the bodies below root, a measure of how well it fits them
+double meanDepth(QuadTree *root);
+
+#endif
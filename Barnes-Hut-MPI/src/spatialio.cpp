@@ -0,0 +1,94 @@
+#include "spatialio.h"
+
+#include <charconv>
+#include <fstream>
+#include <sys/stat.h>
+
+// text is written through a buffer of this many bytes
+#define SPATIAL_CHUNK (1 << 20)
+// an int and 2D + 1 doubles in fixed notation, at their widest
+#define SPATIAL_LINE_MAX(D) (12 + (2 * (D) + 1) * 328 + 1)
+
+template <int D>
+static double *fieldOf(SpatialBody<D> &body, int i) {
+    if (i < D) {
+        return &body.pos[i];
+    }
+    return i == D ? &body.m : &body.vel[i - D - 1];
+}
+
+template <int D>
+static bool readSpatialBinary(const char *fileName, std::vector<SpatialBody<D>> &bodies) {
+    BodyFileHeader header;
+    struct stat info;
+    if (!readHeader(fileName, header) || stat(fileName, &info) != 0
+            || !validHeader(header, sizeof(SpatialBody<D>), info.st_size)) {
+        std::cerr << "ERROR: " << fileName << " is not a complete " << D << "D body file" << std::endl;
+        return false;
+    }
+    std::ifstream input(fileName, std::ifstream::binary);
+    input.seekg(header.headerSize);
+    bodies.resize(header.count);
+    input.read((char *)bodies.data(), header.count * sizeof(SpatialBody<D>));
+    if (!input) {
+        std::cerr << "ERROR: Truncated body file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <int D>
+bool readSpatialFile(const char *fileName, std::vector<SpatialBody<D>> &bodies) {
+    bodies.clear();
+    if (isBinaryFile(fileName)) {
+        return readSpatialBinary(fileName, bodies);
+    }
+    return readTextBodies(fileName, [&](long count) { bodies.reserve(count); },
+            [&](const char *first, const char *last) {
+                SpatialBody<D> body;
+                body.cost = 0;
+                std::from_chars_result res = std::from_chars(first, last, body.index);
+                for (int i = 0; i < 2 * D + 1 && res.ec == std::errc(); i++) {
+                    res = std::from_chars(skipSpace(res.ptr, last), last, *fieldOf(body, i));
+                }
+                if (res.ec != std::errc() || endOfLine(res.ptr, last) == nullptr) {
+                    return (const char *)nullptr;
+                }
+                bodies.push_back(body);
+                return endOfLine(res.ptr, last);
+            });
+}
+
+template <int D>
+void writeSpatialFile(const char *fileName, std::vector<SpatialBody<D>> &bodies, bool binary,
+        int64_t step, double dt, double theta) {
+    std::ofstream out(fileName, std::ofstream::binary | std::ofstream::trunc);
+    if (binary) {
+        BodyFileHeader header = makeHeader(bodies.size(), step, dt, theta);
+        header.recordSize = sizeof(SpatialBody<D>);
+        out.write((const char *)&header, sizeof(header));
+        out.write((const char *)bodies.data(), bodies.size() * sizeof(SpatialBody<D>));
+        return;
+    }
+    std::vector<char> buffer(SPATIAL_CHUNK);
+    char *end = buffer.data() + buffer.size();
+    char *pos = std::to_chars(buffer.data(), end, bodies.size()).ptr;
+    *pos++ = '\n';
+    for (unsigned int b = 0; b < bodies.size(); b++) {
+        if (end - pos < SPATIAL_LINE_MAX(D)) {
+            out.write(buffer.data(), pos - buffer.data());
+            pos = buffer.data();
+        }
+        // same fixed, 6 digit fields as formatBody
+        pos = std::to_chars(pos, end, bodies[b].index).ptr;
+        for (int i = 0; i < 2 * D + 1; i++) {
+            *pos++ = '\t';
+            pos = std::to_chars(pos, end, *fieldOf(bodies[b], i), std::chars_format::fixed, 6).ptr;
+        }
+        *pos++ = '\n';
+    }
+    out.write(buffer.data(), pos - buffer.data());
+}
+
+template bool readSpatialFile<3>(const char *, std::vector<SpatialBody<3>> &);
+template void writeSpatialFile<3>(const char *, std::vector<SpatialBody<3>> &, bool, int64_t, double, double);
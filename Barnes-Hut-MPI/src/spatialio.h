@@ -0,0 +1,22 @@
+#ifndef SPATIALIO_H
+#define SPATIALIO_H
+
+#include <vector>
+
+#include "io.h"
+#include "spatialtree.h"
+
+/**
+ * Body files for SpatialBody<D>. Text lines are "index x y [z] m vx vy [vz]"
+ * after the body count, binary files are the usual BodyFileHeader with
+ * recordSize = sizeof(SpatialBody<D>), which is what tells a 3D file from
+ * a 2D one. Text is read by io.h's chunked readTextBodies.
+ */
+template <int D>
+bool readSpatialFile(const char *fileName, std::vector<SpatialBody<D>> &bodies);
+
+template <int D>
+void writeSpatialFile(const char *fileName, std::vector<SpatialBody<D>> &bodies, bool binary,
+        int64_t step = 0, double dt = 0, double theta = 0);
+
+#endif
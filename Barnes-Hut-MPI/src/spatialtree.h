@@ -0,0 +1,284 @@
+#ifndef SPATIALTREE_H
+#define SPATIALTREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "helpers.h"
+#include "kernels.h"
+#include "morton.h"
+
+/**
+ * A body in D dimensions, laid out like Body with D coordinates. Only
+ * D = 3 is used; 2D runs go through QuadTree and LinearTree.
+ */
+template <int D>
+struct SpatialBody {
+    int index;
+    int cost;
+    double pos[D];
+    double m;
+    double vel[D];
+};
+
+// same update as calcNewPos, on every axis
+template <int D>
+void advance(SpatialBody<D> &body, double dt, const double *force) {
+    for (int k = 0; k < D; k++) {
+        double a = force[k] / body.m;
+        body.pos[k] = body.pos[k] + (body.vel[k] * dt) + (0.5 * a * dt * dt);
+        body.vel[k] = body.vel[k] + (a * dt);
+    }
+}
+
+// pull of one point mass at offset diff on a unit mass, the accumulateAccel law
+template <int D>
+inline void addPoint(const double *diff, double m, double *acc) {
+    double r2 = 0;
+    for (int k = 0; k < D; k++) {
+        r2 += diff[k] * diff[k];
+    }
+    double inv = 1.0 / sqrt(std::max(r2, rLimit * rLimit));
+    double f = G * m * inv * inv * inv;
+    for (int k = 0; k < D; k++) {
+        acc[k] += f * diff[k];
+    }
+}
+
+/**
+ * What changes with the dimension: how a coordinate's bits are spread
+ * into a Morton key, and the kernel for the bodies of a leaf. Keys keep 64 / D bits per
+ * axis, axis k at bit k of every D-bit digit, so a digit is also the
+ * child index (bit k set: upper half along axis k).
+ */
+template <int D>
+struct Spatial;
+
+template <>
+struct Spatial<3> {
+    static const int bits = 21;
+
+    // 0b abc -> 0b 00a00b00c, for the low 21 bits
+    static uint64_t spread(uint32_t v) {
+        uint64_t x = v & 0x1FFFFF;
+        x = (x | (x << 32)) & 0x001F00000000FFFFULL;
+        x = (x | (x << 16)) & 0x001F0000FF0000FFULL;
+        x = (x | (x << 8))  & 0x100F00F00F00F00FULL;
+        x = (x | (x << 4))  & 0x10C30C30C30C30C3ULL;
+        x = (x | (x << 2))  & 0x1249249249249249ULL;
+        return x;
+    }
+
+    static void accumulate(const double *target, const double *const *pos, const double *m,
+            int count, double *acc) {
+        accumulateAccel3(target[0], target[1], target[2], pos[0], pos[1], pos[2], m, count,
+                acc[0], acc[1], acc[2]);
+    }
+};
+
+/**
+ * One cell of a SpatialTree, laid out like LinearNode: children start at
+ * i + 1 and the subtree ends right before `next`.
+ */
+template <int D>
+struct SpatialNode {
+    double com[D];      // centre of mass
+    double m;
+    double halfWidth;   // half the side length of the cell
+    int next;
+    int first;          // leaf bodies [first, first + count)
+    int count;
+};
+
+/**
+ * Barnes-Hut tree over D dimensions (an octree for 3), built
+ * from Morton-sorted keys like LinearTree::buildSorted and walked the
+ * same way. The bodies themselves are not reordered: leaf arrays hold
+ * copies in tree order, and `source` says where each came from.
+ */
+template <int D>
+class SpatialTree {
+public:
+    static const int children = 1 << D;
+
+    std::vector<SpatialNode<D>> nodes;
+    // leaf bodies in depth-first order, one array per coordinate
+    std::vector<double> pos[D];
+    std::vector<double> m;
+    std::vector<int> index;
+    std::vector<int> source;
+
+    /**
+     * Smallest cube around every body with mass, like findBounds (bounds.h):
+     * fills min[D] and returns the side length.
+     */
+    static double findCube(const std::vector<SpatialBody<D>> &bodies, double *min) {
+        double max[D];
+        bool any = false;
+        for (const SpatialBody<D> &body : bodies) {
+            if (body.m <= 0) {
+                continue;
+            }
+            for (int k = 0; k < D; k++) {
+                min[k] = any ? std::min(min[k], body.pos[k]) : body.pos[k];
+                max[k] = any ? std::max(max[k], body.pos[k]) : body.pos[k];
+            }
+            any = true;
+        }
+        double side = 0;
+        for (int k = 0; k < D && any; k++) {
+            side = std::max(side, max[k] - min[k]);
+        }
+        if (side <= 0) {
+            side = 1.0;
+        }
+        for (int k = 0; k < D; k++) {
+            min[k] = any ? min[k] - side * 1e-9 : 0.0;
+        }
+        return side * (1 + 2e-9);
+    }
+
+    /**
+     * Builds over the cube [min[k], min[k] + width) on every axis k.
+     * Bodies that QuadTree::insert would drop (no mass or out of bounds)
+     * get m = -1 and are left out.
+     */
+    void build(std::vector<SpatialBody<D>> &bodies, const double *min, double width) {
+        nodes.clear();
+        m.clear();
+        index.clear();
+        source.clear();
+        for (int k = 0; k < D; k++) {
+            pos[k].clear();
+        }
+        std::vector<uint64_t> keys;
+        for (unsigned int i = 0; i < bodies.size(); i++) {
+            SpatialBody<D> &body = bodies[i];
+            bool inside = body.m > 0;
+            for (int k = 0; k < D; k++) {
+                inside = inside && body.pos[k] >= min[k] && body.pos[k] <= min[k] + width;
+            }
+            if (!inside) {
+                body.m = -1.0;
+                continue;
+            }
+            uint64_t key = 0;
+            for (int k = 0; k < D; k++) {
+                key |= Spatial<D>::spread(quantize(body.pos[k], min[k], width)) << k;
+            }
+            keys.push_back(key);
+            source.push_back(i);
+        }
+        radixSort(keys, source);
+        for (unsigned int b = 0; b < source.size(); b++) {
+            const SpatialBody<D> &body = bodies[source[b]];
+            for (int k = 0; k < D; k++) {
+                pos[k].push_back(body.pos[k]);
+            }
+            m.push_back(body.m);
+            index.push_back(body.index);
+        }
+        if (!keys.empty()) {
+            buildRange(keys, 0, keys.size(), 0, width / 2);
+        }
+    }
+
+    // force on body from every other body in the tree, into force[D]
+    void calcForceOn(const SpatialBody<D> &body, double theta, double *force) const {
+        double acc[D] = {};
+        const double *leafPos[D];
+        for (int k = 0; k < D; k++) {
+            leafPos[k] = pos[k].data();
+        }
+        int end = nodes.size();
+        int i = 0;
+        while (i < end) {
+            const SpatialNode<D> &node = nodes[i];
+            if (node.next == i + 1) {
+                // a body meets itself at distance 0, which adds exactly 0
+                const double *first[D];
+                for (int k = 0; k < D; k++) {
+                    first[k] = leafPos[k] + node.first;
+                }
+                Spatial<D>::accumulate(body.pos, first, m.data() + node.first, node.count, acc);
+                i = node.next;
+                continue;
+            }
+            double diff[D];
+            double d2 = 0;
+            for (int k = 0; k < D; k++) {
+                diff[k] = node.com[k] - body.pos[k];
+                d2 += diff[k] * diff[k];
+            }
+            if (checkMAC(2 * node.halfWidth, sqrt(d2), theta)) {
+                addPoint<D>(diff, node.m, acc);
+                i = node.next;
+            } else {
+                i++;
+            }
+        }
+        for (int k = 0; k < D; k++) {
+            force[k] = body.m * acc[k];
+        }
+    }
+
+private:
+    static uint32_t quantize(double v, double min, double width) {
+        double scaled = (v - min) / width * (double)(1ULL << Spatial<D>::bits);
+        double top = (double)((1ULL << Spatial<D>::bits) - 1);
+        if (scaled <= 0) {
+            return 0;
+        }
+        return scaled >= top ? (uint32_t)top : (uint32_t)scaled;
+    }
+
+    static int digit(uint64_t key, int level) {
+        return (key >> (D * (Spatial<D>::bits - 1 - level))) & (children - 1);
+    }
+
+    void buildRange(std::vector<uint64_t> &keys, int lo, int hi, int level, double halfWidth) {
+        int current = nodes.size();
+        SpatialNode<D> temp;
+        temp.halfWidth = halfWidth;
+        temp.first = lo;
+        temp.count = hi - lo;
+        nodes.push_back(temp);
+
+        double mass = 0;
+        double moment[D] = {};
+        if (hi - lo == 1 || level == Spatial<D>::bits) {
+            // bodies that share a full key stay together in one leaf
+            for (int b = lo; b < hi; b++) {
+                mass += m[b];
+                for (int k = 0; k < D; k++) {
+                    moment[k] += pos[k][b] * m[b];
+                }
+            }
+        } else {
+            int start = lo;
+            for (int c = 0; c < children && start < hi; c++) {
+                int end = std::partition_point(keys.begin() + start, keys.begin() + hi,
+                        [level, c](uint64_t key) { return digit(key, level) <= c; })
+                        - keys.begin();
+                if (end > start) {
+                    int child = nodes.size();
+                    buildRange(keys, start, end, level + 1, halfWidth / 2);
+                    mass += nodes[child].m;
+                    for (int k = 0; k < D; k++) {
+                        moment[k] += nodes[child].com[k] * nodes[child].m;
+                    }
+                }
+                start = end;
+            }
+        }
+        SpatialNode<D> &node = nodes[current];
+        node.m = mass;
+        for (int k = 0; k < D; k++) {
+            node.com[k] = hi - lo == 1 ? pos[k][lo] : moment[k] / mass;
+        }
+        node.next = nodes.size();
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads)
+        : job(nullptr), grain(1), generation(0), running(0), stopping(false) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        ranges.push_back(std::unique_ptr<Range>(new Range()));
+        ranges[i]->begin = 0;
+        ranges[i]->end = 0;
+    }
+    for (int i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+int ThreadPool::size() {
+    return ranges.size();
+}
+
+void ThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)> &body) {
+    int threads = size();
+    if (threads == 1 || count <= grain) {
+        for (int i = 0; i < count; i++) {
+            body(i, 0);
+        }
+        return;
+    }
+    for (int t = 0; t < threads; t++) {
+        ranges[t]->begin = (long long)count * t / threads;
+        ranges[t]->end = (long long)count * (t + 1) / threads;
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        job = &body;
+        this->grain = grain > 0 ? grain : 1;
+        running = threads - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> guard(mutex);
+    finished.wait(guard, [this] { return running == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop(int id) {
+    int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            wake.wait(guard, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        work(id);
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            running--;
+        }
+        finished.notify_one();
+    }
+}
+
+void ThreadPool::work(int id) {
+    int begin, end;
+    while (true) {
+        while (takeChunk(id, begin, end)) {
+            for (int i = begin; i < end; i++) {
+                (*job)(i, id);
+            }
+        }
+        if (!steal(id)) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::takeChunk(int id, int &begin, int &end) {
+    Range &own = *ranges[id];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (own.begin >= own.end) {
+        return false;
+    }
+    begin = own.begin;
+    end = std::min(own.begin + grain, own.end);
+    own.begin = end;
+    return true;
+}
+
+/**
+ * Moves the back half of the fullest other range into this thread's own.
+ * Returns false once every range is empty. Work already taken by a thief
+ * is finished by that thief, so seeing nothing left means this thread
+ * is done.
+ */
+bool ThreadPool::steal(int id) {
+    int threads = size();
+    while (true) {
+        int victim = -1;
+        int most = 0;
+        for (int t = 0; t < threads; t++) {
+            if (t == id) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(ranges[t]->lock);
+            int left = ranges[t]->end - ranges[t]->begin;
+            if (left > most) {
+                most = left;
+                victim = t;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> guard(ranges[victim]->lock);
+            int left = ranges[victim]->end - ranges[victim]->begin;
+            if (left <= 0) {
+                // someone else got there first, look again
+                continue;
+            }
+            end = ranges[victim]->end;
+            begin = end - (left + 1) / 2;
+            ranges[victim]->end = begin;
+        }
+        std::lock_guard<std::mutex> guard(ranges[id]->lock);
+        ranges[id]->begin = begin;
+        ranges[id]->end = end;
+        return true;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads for data-parallel loops inside a rank.
+ *
+ * parallelFor splits [0, count) into one contiguous range per thread.
+ * Each thread takes `grain` items at a time from the front of its own
+ * range. Once that runs dry, it steals the back half of the fullest other
+ * range. The calling thread works as thread 0, so a pool of size 1 has
+ * no workers and simply runs the loop inline.
+ */
+class ThreadPool {
+public:
+    ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size();
+
+    // calls body(item, thread) once for every item, returns when all are done
+    void parallelFor(int count, int grain, const std::function<void(int, int)> &body);
+
+private:
+    struct Range {
+        std::mutex lock;
+        int begin;
+        int end;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Range>> ranges;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(int, int)> *job;
+    int grain;
+    int generation;
+    int running;
+    bool stopping;
+
+    void workerLoop(int id);
+    void work(int id);
+    bool takeChunk(int id, int &begin, int &end);
+    bool steal(int id);
+};
+
+#endif
@@ -0,0 +1,397 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <zlib.h>
+
+// byte b of value k goes to b * values + k, which puts the sign/exponent
+// bytes of neighbouring 4-byte values next to each other for deflate
+static void shuffle(const unsigned char *bytes, int values, std::vector<unsigned char> &out) {
+    out.resize(values * 4);
+    for (int k = 0; k < values; k++) {
+        for (int b = 0; b < 4; b++) {
+            out[b * values + k] = bytes[k * 4 + b];
+        }
+    }
+}
+
+static void unshuffle(const std::vector<unsigned char> &in, int values, unsigned char *bytes) {
+    for (int k = 0; k < values; k++) {
+        for (int b = 0; b < 4; b++) {
+            bytes[k * 4 + b] = in[b * values + k];
+        }
+    }
+}
+
+TrajectoryWriter::TrajectoryWriter(MPI_Comm comm, int count, double dt, int every)
+        : comm(comm), count(count), dt(dt), every(every), opened(false), end(0), frames(0),
+          compressed(0), closing(false) {
+    MPI_Comm_rank(comm, &rank);
+}
+
+bool TrajectoryWriter::open(const std::string &fileName, int64_t firstStep) {
+    // where the kept frames end and how many there are, or -1 for a file
+    // that belongs to some other run
+    int64_t resume[2] = { sizeof(TrajectoryHeader), 0 };
+    if (rank == 0 && firstStep > 0 && std::ifstream(fileName).good()) {
+        TrajectoryReader reader;
+        if (!reader.open(fileName) || reader.version() != TRAJECTORY_VERSION
+                || reader.count() != count || reader.every() != every) {
+            resume[0] = -1;
+        } else {
+            for (int f = 0; f < reader.frames() && reader.step(f) < firstStep; f++) {
+                TrajectoryIndexEntry entry = { reader.step(f), reader.offset(f) };
+                index.push_back(entry);
+                resume[0] = reader.end(f);
+                resume[1]++;
+            }
+        }
+    }
+    MPI_Bcast(resume, 2, MPI_INT64_T, 0, comm);
+    if (resume[0] < 0) {
+        return false;
+    }
+    int failed = MPI_File_open(comm, fileName.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+            &file) != MPI_SUCCESS;
+    int anyFailed;
+    MPI_Allreduce(&failed, &anyFailed, 1, MPI_INT, MPI_MAX, comm);
+    if (anyFailed) {
+        if (!failed) {
+            MPI_File_close(&file);
+        }
+        return false;
+    }
+
+    // drop whatever followed the kept frames, an old index or frames from
+    // the steps being run again
+    end = resume[0];
+    frames = resume[1];
+    MPI_File_set_size(file, end);
+    if (rank == 0 && frames == 0) {
+        TrajectoryHeader header = {};
+        memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+        header.version = TRAJECTORY_VERSION;
+        header.headerSize = sizeof(TrajectoryHeader);
+        header.count = count;
+        header.dt = dt;
+        header.every = every;
+        MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    opened = true;
+    thread = std::thread(&TrajectoryWriter::compressFrames, this);
+    return true;
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    if (!opened) {
+        return;
+    }
+    while (!queue.empty()) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [this]() { return compressed > 0; });
+        }
+        poll();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    ready.notify_one();
+    thread.join();
+    while (!writes.empty()) {
+        MPI_Wait(&writes.front().request, MPI_STATUS_IGNORE);
+        writes.pop_front();
+    }
+
+    uint64_t indexBytes = frames * sizeof(TrajectoryIndexEntry);
+    if (rank == 0) {
+        TrajectoryTrailer trailer = {};
+        trailer.indexOffset = end;
+        trailer.frames = frames;
+        memcpy(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(trailer.magic));
+        MPI_File_write_at(file, end, index.data(), indexBytes, MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at(file, end + indexBytes, &trailer, sizeof(trailer), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_set_size(file, end + indexBytes + sizeof(TrajectoryTrailer));
+    MPI_File_close(&file);
+}
+
+void TrajectoryWriter::add(int64_t step, std::vector<Body> &bodies) {
+    Frame frame;
+    frame.step = step;
+    frame.index.reserve(bodies.size());
+    frame.x.reserve(bodies.size());
+    frame.y.reserve(bodies.size());
+    for (unsigned int j = 0; j < bodies.size(); j++) {
+        if (bodies[j].index >= 0 && bodies[j].index < count) {
+            frame.index.push_back(bodies[j].index);
+            frame.x.push_back(bodies[j].x);
+            frame.y.push_back(bodies[j].y);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(std::move(frame));
+    }
+    ready.notify_one();
+    poll();
+    // every rank holds the same number of frames, so they all wait together
+    while (queue.size() > TRAJECTORY_MAX_PENDING) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [this]() { return compressed > 0; });
+        }
+        poll();
+    }
+}
+
+void TrajectoryWriter::poll() {
+    while (!writes.empty()) {
+        int finished;
+        MPI_Test(&writes.front().request, &finished, MPI_STATUS_IGNORE);
+        if (!finished) {
+            break;
+        }
+        writes.pop_front();
+    }
+    if (queue.empty()) {
+        return;
+    }
+    int mine;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        mine = compressed;
+    }
+    int everyone;
+    MPI_Allreduce(&mine, &everyone, 1, MPI_INT, MPI_MIN, comm);
+    for (int f = 0; f < everyone; f++) {
+        writeFrame();
+    }
+    while (writes.size() > TRAJECTORY_MAX_PENDING) {
+        MPI_Wait(&writes.front().request, MPI_STATUS_IGNORE);
+        writes.pop_front();
+    }
+}
+
+// places every rank's part of the oldest frame after the frames before it
+void TrajectoryWriter::writeFrame() {
+    Frame frame;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        frame = std::move(queue.front());
+        queue.pop_front();
+        compressed--;
+    }
+    uint64_t part = frame.bytes.size() - sizeof(FrameHeader);
+    uint64_t before = 0;
+    uint64_t total;
+    MPI_Exscan(&part, &before, 1, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(&part, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    // rank 0 writes the frame header in front of its part
+    uint64_t skip = sizeof(FrameHeader);
+    MPI_Offset at = end + sizeof(FrameHeader) + (rank == 0 ? 0 : before);
+    if (rank == 0) {
+        FrameHeader header = { frame.step, total };
+        memcpy(frame.bytes.data(), &header, sizeof(header));
+        TrajectoryIndexEntry entry = { frame.step, end };
+        index.push_back(entry);
+        skip = 0;
+        at = end;
+    }
+    end += sizeof(FrameHeader) + total;
+    frames++;
+
+    writes.push_back(Write());
+    Write &write = writes.back();
+    write.bytes = std::move(frame.bytes);
+    MPI_File_iwrite_at(file, at, write.bytes.data() + skip, write.bytes.size() - skip, MPI_BYTE,
+            &write.request);
+}
+
+void TrajectoryWriter::compressFrames() {
+    std::vector<int> order;
+    std::vector<unsigned char> values;
+    std::vector<unsigned char> shuffled;
+    while (true) {
+        Frame *frame;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return closing || compressed < queue.size(); });
+            if (compressed == queue.size()) {
+                return;
+            }
+            // add() only appends, so the frame stays put while it's compressed
+            frame = &queue[compressed];
+        }
+
+        int n = frame->index.size();
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [frame](int a, int b) { return frame->index[a] < frame->index[b]; });
+        values.resize(3 * n * 4);
+        for (int k = 0; k < n; k++) {
+            memcpy(&values[4 * k], &frame->index[order[k]], 4);
+            memcpy(&values[4 * (n + k)], &frame->x[order[k]], 4);
+            memcpy(&values[4 * (2 * n + k)], &frame->y[order[k]], 4);
+        }
+        shuffle(values.data(), 3 * n, shuffled);
+
+        uLongf length = compressBound(shuffled.size());
+        std::vector<unsigned char> &bytes = frame->bytes;
+        bytes.resize(sizeof(FrameHeader) + sizeof(PartHeader) + length);
+        PartHeader part = { (uint64_t)n, length };
+        if (compress2(bytes.data() + sizeof(FrameHeader) + sizeof(PartHeader), &length,
+                shuffled.data(), shuffled.size(), Z_BEST_SPEED) != Z_OK) {
+            // an empty part keeps the frame in step with the other ranks
+            std::cerr << "ERROR: Unable to compress trajectory frame " << frame->step << std::endl;
+            part.bodies = 0;
+            length = 0;
+        }
+        part.compressedSize = length;
+        memcpy(bytes.data() + sizeof(FrameHeader), &part, sizeof(part));
+        bytes.resize(sizeof(FrameHeader) + sizeof(PartHeader) + length);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            compressed++;
+        }
+        done.notify_one();
+    }
+}
+
+bool TrajectoryReader::open(const std::string &fileName) {
+    in.open(fileName, std::ifstream::binary);
+    if (!in.read((char *)&header, sizeof(header))
+            || memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) != 0) {
+        return false;
+    }
+
+    TrajectoryTrailer trailer;
+    in.seekg(-(long)sizeof(trailer), std::ifstream::end);
+    if (in.read((char *)&trailer, sizeof(trailer))
+            && memcmp(trailer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(trailer.magic)) == 0) {
+        index.resize(trailer.frames);
+        in.seekg(trailer.indexOffset);
+        in.read((char *)index.data(), index.size() * sizeof(TrajectoryIndexEntry));
+        return (bool)in;
+    }
+
+    // no trailer, walk the frames that made it to disk
+    in.clear();
+    in.seekg(0, std::ifstream::end);
+    uint64_t length = in.tellg();
+    uint64_t offset = header.headerSize;
+    FrameHeader frame;
+    while (offset + sizeof(frame) <= length) {
+        in.seekg(offset);
+        in.read((char *)&frame, sizeof(frame));
+        if (offset + sizeof(frame) + frame.compressedSize > length) {
+            break;
+        }
+        TrajectoryIndexEntry entry = { frame.step, offset };
+        index.push_back(entry);
+        offset += sizeof(frame) + frame.compressedSize;
+    }
+    in.clear();
+    return true;
+}
+
+int TrajectoryReader::frames() {
+    return index.size();
+}
+
+int64_t TrajectoryReader::step(int frame) {
+    return index[frame].step;
+}
+
+uint64_t TrajectoryReader::offset(int frame) {
+    return index[frame].offset;
+}
+
+uint64_t TrajectoryReader::end(int frame) {
+    FrameHeader frameHeader;
+    in.seekg(index[frame].offset);
+    in.read((char *)&frameHeader, sizeof(frameHeader));
+    in.clear();
+    return index[frame].offset + sizeof(frameHeader) + frameHeader.compressedSize;
+}
+
+int TrajectoryReader::count() {
+    return header.count;
+}
+
+int TrajectoryReader::every() {
+    return header.every;
+}
+
+int TrajectoryReader::version() {
+    return header.version;
+}
+
+bool TrajectoryReader::read(int frame, std::vector<float> &x, std::vector<float> &y) {
+    FrameHeader frameHeader;
+    in.seekg(index[frame].offset);
+    in.read((char *)&frameHeader, sizeof(frameHeader));
+    std::vector<unsigned char> compressed(frameHeader.compressedSize);
+    in.read((char *)compressed.data(), compressed.size());
+    if (!in) {
+        in.clear();
+        return false;
+    }
+
+    if (header.version == 1) {
+        int values = 2 * header.count;
+        std::vector<unsigned char> shuffled(values * sizeof(float));
+        uLongf length = shuffled.size();
+        if (uncompress(shuffled.data(), &length, compressed.data(), compressed.size()) != Z_OK
+                || length != shuffled.size()) {
+            return false;
+        }
+        std::vector<float> positions(values);
+        unshuffle(shuffled, values, (unsigned char *)positions.data());
+        x.assign(positions.begin(), positions.begin() + header.count);
+        y.assign(positions.begin() + header.count, positions.end());
+        return true;
+    }
+
+    // the parts hold count bodies between them
+    x.assign(header.count, 0.0f);
+    y.assign(header.count, 0.0f);
+    uint64_t placed = 0;
+    uint64_t at = 0;
+    std::vector<unsigned char> shuffled;
+    std::vector<unsigned char> values;
+    while (at + sizeof(PartHeader) <= compressed.size()) {
+        PartHeader part;
+        memcpy(&part, &compressed[at], sizeof(part));
+        at += sizeof(part);
+        if (part.compressedSize > compressed.size() - at || part.bodies > header.count - placed) {
+            return false;
+        }
+        int n = part.bodies;
+        shuffled.resize(3 * n * 4);
+        uLongf length = shuffled.size();
+        if (n > 0 && (uncompress(shuffled.data(), &length, &compressed[at], part.compressedSize) != Z_OK
+                || length != shuffled.size())) {
+            return false;
+        }
+        at += part.compressedSize;
+        values.resize(shuffled.size());
+        unshuffle(shuffled, 3 * n, values.data());
+        for (int k = 0; k < n; k++) {
+            int body;
+            memcpy(&body, &values[4 * k], 4);
+            if (body < 0 || (uint64_t)body >= header.count) {
+                return false;
+            }
+            memcpy(&x[body], &values[4 * (n + k)], 4);
+            memcpy(&y[body], &values[4 * (2 * n + k)], 4);
+        }
+        placed += n;
+    }
+    return placed == header.count;
+}
@@ -0,0 +1,162 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpi.h"
+#include "body.h"
+
+/**
+ * Trajectory files hold the positions of every body at selected steps:
+ *
+ *   TrajectoryHeader
+ *   per frame: FrameHeader, then compressedSize bytes of parts, one per
+ *     rank that wrote the frame. A part is a PartHeader followed by its
+ *     bodies' int32 indices, float32 x and float32 y, byte shuffled (all
+ *     first bytes, then all second bytes, ...) and deflated with zlib
+ *   the index, one TrajectoryIndexEntry per frame
+ *   TrajectoryTrailer
+ *
+ * Frames don't depend on each other, so a reader can seek to any of them
+ * through the index. A file cut short by a crash has no trailer, and the
+ * reader rebuilds the index by walking the frame headers. Version 1
+ * frames were a single part of x[count] then y[count] in index order,
+ * with no PartHeader or indices.
+ */
+#define TRAJECTORY_MAGIC "NBODYTRJ"
+#define TRAJECTORY_INDEX_MAGIC "NBODYIDX"
+#define TRAJECTORY_VERSION 2
+
+// frames a rank holds, queued or being written, before add() waits
+#define TRAJECTORY_MAX_PENDING 4
+
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t count;
+    double dt;
+    int64_t every;
+};
+
+struct FrameHeader {
+    int64_t step;
+    uint64_t compressedSize;
+};
+
+struct PartHeader {
+    uint64_t bodies;
+    uint64_t compressedSize;
+};
+
+struct TrajectoryIndexEntry {
+    int64_t step;
+    uint64_t offset;
+};
+
+struct TrajectoryTrailer {
+    uint64_t indexOffset;
+    uint64_t frames;
+    char magic[8];
+};
+
+/**
+ * The writing end of a trajectory, on every rank of `comm`: rank 0 alone
+ * (MPI_COMM_SELF) in replicated runs, every rank in distributed ones, so
+ * no rank ever needs more than its own bodies.
+ *
+ * add() only copies the rank's positions and queues them. A dedicated
+ * I/O thread sorts them by index, compresses them and leaves them for
+ * poll(), which places each rank's part with a nonblocking MPI-IO write
+ * once every rank has compressed the frame. MPI is only called from the
+ * step loop's thread. With TRAJECTORY_MAX_PENDING frames held, add()
+ * waits for the oldest one to be written, so output that falls behind
+ * slows the run down instead of growing without bound.
+ */
+class TrajectoryWriter {
+public:
+    TrajectoryWriter(MPI_Comm comm, int count, double dt, int every);
+    // writes every frame still held and the index, collective over comm
+    ~TrajectoryWriter();
+
+    // Collective. A run restarted at firstStep > 0 keeps the frames of an
+    // existing trajectory before firstStep and appends after them. False,
+    // on every rank, if the file can't be opened or is not a version 2
+    // trajectory with the same count and every.
+    bool open(const std::string &fileName, int64_t firstStep);
+
+    // collective; this rank's bodies, in any order
+    void add(int64_t step, std::vector<Body> &bodies);
+    // collective; starts the writes of the frames every rank has compressed
+    void poll();
+
+private:
+    struct Frame {
+        int64_t step;
+        std::vector<int> index;
+        std::vector<float> x;
+        std::vector<float> y;
+        // FrameHeader room, then this rank's part, filled in by the I/O thread
+        std::vector<unsigned char> bytes;
+    };
+
+    struct Write {
+        std::vector<unsigned char> bytes;
+        MPI_Request request;
+    };
+
+    MPI_Comm comm;
+    int rank;
+    int count;
+    double dt;
+    int every;
+    bool opened;
+    MPI_File file;
+    // where the next frame goes, and the frames before it
+    uint64_t end;
+    uint64_t frames;
+    // frames added but not written yet, the first `compressed` of them ready
+    std::deque<Frame> queue;
+    size_t compressed;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable done;
+    bool closing;
+    std::deque<Write> writes;
+    // on rank 0
+    std::vector<TrajectoryIndexEntry> index;
+    std::thread thread;
+
+    void compressFrames();
+    void writeFrame();
+};
+
+class TrajectoryReader {
+public:
+    // false if fileName isn't a trajectory
+    bool open(const std::string &fileName);
+    int frames();
+    int64_t step(int frame);
+    // where `frame` starts, and one past its last byte
+    uint64_t offset(int frame);
+    uint64_t end(int frame);
+    int count();
+    int every();
+    int version();
+    // positions of every body at `frame`, in index order
+    bool read(int frame, std::vector<float> &x, std::vector<float> &y);
+
+private:
+    std::ifstream in;
+    TrajectoryHeader header;
+    std::vector<TrajectoryIndexEntry> index;
+};
+
+#endif
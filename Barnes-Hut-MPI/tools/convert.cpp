@@ -0,0 +1,28 @@
+#include "io.h"
+
+#include <vector>
+
+/**
+ * Converts a body file between the text and binary formats. The direction
+ * follows the input: text becomes binary and binary becomes text.
+ *
+ * ./convert input/nb-100.txt input/nb-100.bin
+ */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cout << "Usage: " << argv[0] << " <input_file> <output_file>" << std::endl;
+        return 1;
+    }
+    std::vector<Body> bodies;
+    bool binary = isBinaryFile(argv[1]);
+    if (!readFile(argv[1], nullptr, bodies)) {
+        return 1;
+    }
+    if (binary) {
+        writeTextFile(argv[2], bodies);
+    } else {
+        writeBinaryFile(argv[2], bodies);
+    }
+    std::cout << bodies.size() << " bodies, " << (binary ? "binary -> text" : "text -> binary") << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "fmm.h"
+#include "io.h"
+#include "kernels.h"
+#include "lineartree.h"
+#include "morton.h"
+#include "threadpool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// relative RMS force error against the direct sum
+static double rmsError(std::vector<std::pair<double, double>> &forces,
+        std::vector<std::pair<double, double>> &exact) {
+    double err = 0, norm = 0;
+    for (unsigned int b = 0; b < forces.size(); b++) {
+        double dx = forces[b].first - exact[b].first;
+        double dy = forces[b].second - exact[b].second;
+        err += dx * dx + dy * dy;
+        norm += exact[b].first * exact[b].first + exact[b].second * exact[b].second;
+    }
+    return sqrt(err / norm);
+}
+
+/**
+ * Accuracy against cost for the FMM (-e) and the Barnes-Hut walk, both
+ * measured against the O(N^2) direct sum on the same bodies. One line per
+ * method, order and theta, ready for plotting.
+ *
+ * ./fmmcheck input/nb-20000.txt [max_order]
+ */
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        std::cout << "Usage: " << argv[0] << " <input_file> [max_order]" << std::endl;
+        return 1;
+    }
+    int maxOrder = argc == 3 ? atoi(argv[2]) : 8;
+    std::vector<Body> bodies;
+    if (!readFile(argv[1], nullptr, bodies)) {
+        return 1;
+    }
+
+    Quadrant bounds(0.0, 0.0, 4.0, 4.0);
+    std::vector<uint64_t> keys;
+    int count = sortByMorton(bodies, bounds, keys);
+    LinearTree tree;
+    tree.buildSorted(bodies, keys, count, bounds);
+    int n = tree.leaves.size();
+    // one thread, so the timings compare with the serial walks
+    ThreadPool pool(1);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<double, double>> exact(n);
+    for (int b = 0; b < n; b++) {
+        double ax = 0, ay = 0;
+        accumulateAccel(tree.leaves.x[b], tree.leaves.y[b], tree.leaves.x.data(),
+                tree.leaves.y.data(), tree.leaves.m.data(), n, ax, ay);
+        exact[b] = std::make_pair(tree.leaves.m[b] * ax, tree.leaves.m[b] * ay);
+    }
+    printf("# %d bodies, direct sum %.3f s\n", n, seconds(start));
+    printf("# method order theta seconds error\n");
+
+    std::vector<std::pair<double, double>> forces(n);
+    const double thetas[] = { 0.3, 0.5, 0.7, 0.9 };
+    for (double theta : thetas) {
+        for (int quadrupole = 0; quadrupole < 2; quadrupole++) {
+            start = std::chrono::steady_clock::now();
+            for (int b = 0; b < n; b++) {
+                Body body;
+                body.index = tree.leaves.index[b];
+                body.x = tree.leaves.x[b];
+                body.y = tree.leaves.y[b];
+                body.m = tree.leaves.m[b];
+                forces[b] = tree.calcForceOn(&body, theta, quadrupole);
+            }
+            double time = seconds(start);
+            printf("bh %d %.2f %.4f %.3e\n", quadrupole ? 2 : 0, theta, time, rmsError(forces, exact));
+        }
+        for (int order = 1; order <= maxOrder; order++) {
+            FMM fmm(order);
+            start = std::chrono::steady_clock::now();
+            fmm.calcForces(tree, theta, pool, nullptr, forces);
+            double time = seconds(start);
+            printf("fmm %d %.2f %.4f %.3e\n", order, theta, time, rmsError(forces, exact));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "trajectory.h"
+
+#include <cstdio>
+#include <iostream>
+
+/**
+ * Lists the frames of a trajectory file, or prints one of them as
+ * tab separated "index x y" lines.
+ *
+ * ./frames out/nb-100.traj
+ * ./frames out/nb-100.traj 3
+ */
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        std::cout << "Usage: " << argv[0] << " <trajectory_file> [frame]" << std::endl;
+        return 1;
+    }
+    TrajectoryReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "ERROR: " << argv[1] << " is not a trajectory" << std::endl;
+        return 1;
+    }
+    if (argc == 2) {
+        std::cout << reader.frames() << " frames of " << reader.count() << " bodies" << std::endl;
+        for (int f = 0; f < reader.frames(); f++) {
+            std::cout << f << "\tstep " << reader.step(f) << std::endl;
+        }
+        return 0;
+    }
+
+    int frame = atoi(argv[2]);
+    std::vector<float> x, y;
+    if (frame < 0 || frame >= reader.frames() || !reader.read(frame, x, y)) {
+        std::cerr << "ERROR: Unable to read frame " << frame << std::endl;
+        return 1;
+    }
+    for (int k = 0; k < reader.count(); k++) {
+        printf("%d\t%f\t%f\n", k, x[k], y[k]);
+    }
+    return 0;
+}